@@ -3,40 +3,124 @@
 #include <string>
 #include <protocol.h>
 #include <connection.h>
+#include <options.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
 #include <random>
+#include <thread>
+#include <vector>
 
 namespace asio = boost::asio;
 using boost::system::error_code;
 using tcp = asio::ip::tcp;
 using namespace std::chrono_literals;
 
-class client_dispatcher : public i_client_dispatcher
+class client_dispatcher final : public i_client_dispatcher
 {
 public:
-	void process(const get_command_response_ptr& cmd, const i_socket_ptr& socket) override
+	void process(const get_command_response& cmd, const i_socket_ptr&) override
 	{
-		static int count = 0;
-		if (++count % 1000 == 0) {
-			std::cout << "Processed " << count << " get responses\n";
+		if (++count_ % 1000 == 0) {
+			std::cout << "Processed " << count_ << " get responses\n";
 		
-			std::cout << "Received response for key: " << cmd->get_key() << std::endl
-				<< ", value: " << cmd->get_value() << std::endl
-				<< ", reads: " << cmd->get_reads() << std::endl
-				<< ", writes: " << cmd->get_writes() << std::endl;
+			std::cout << "Received response for key: " << cmd.key << std::endl
+				<< ", value: " << cmd.value << std::endl
+				<< ", reads: " << cmd.reads << std::endl
+				<< ", writes: " << cmd.writes << std::endl;
 		}
+		if(on_response) on_response();
 	}
+
+	void process(const multi_get_command_response& cmd, const i_socket_ptr&) override
+	{
+		std::cout << "Received multi-get response with " << cmd.items.size() << " keys\n";
+		if(on_response) on_response();
+	}
+
+	void process(const credit_command& cmd, const i_socket_ptr&) override
+	{
+		if(on_credit) on_credit(cmd.credits);
+	}
+
+	void process(const error_response& cmd, const i_socket_ptr&) override
+	{
+		std::cerr << "Request " << cmd.request_id << " failed: " << cmd.message << '\n';
+		if(on_response) on_response();
+	}
+
+	std::function<void(uint32_t)> on_credit;
+	std::function<void()>         on_response;
+
+private:
+	std::uint64_t count_ = 0; // у каждого spammer свой диспетчер — счёт без гонок между потоками
 };
 
 using connection = t_connection<client_dispatcher>;
 using connection_ptr = std::shared_ptr<connection>;
 
+// -----------------------------------------------------------------------------
+// Настройки клиента (из командной строки)
+// -----------------------------------------------------------------------------
+struct client_config
+{
+	std::string host        = "127.0.0.1";
+	std::string port        = "9000";
+	std::size_t commands    = 1000000; // на соединение
+	unsigned    set_percent = 1;       // доля SET среди команд, %
+	std::size_t connections = 1;
+	std::size_t threads     = 1;       // у каждого потока свой io_context, соединения — по кругу
+	std::size_t pipeline    = 0;       // > 0 — не больше стольких GET без ответа на соединение
+	std::size_t greedy      = 0;       // первые greedy соединений шлют без --pipeline (проверка честности)
+	std::size_t hold_ms     = 0;       // после всех ответов соединение ещё столько держится открытым
+	bool        credits     = false;   // сервер с --credit-window: до первого CREDIT не слать ничего
+
+	explicit client_config(const options& opts)
+	{
+		host        = opts.get("host", host);
+		port        = opts.get("port", port);
+		commands    = opts.get("commands", commands);
+		set_percent = std::min(opts.get("set-percent", set_percent), 100u);
+		connections = std::max<std::size_t>(opts.get("connections", connections), 1);
+		threads     = std::clamp<std::size_t>(opts.get("threads", threads), 1, connections);
+		pipeline    = opts.get("pipeline", pipeline);
+		greedy      = std::min(opts.get("greedy", greedy), connections);
+		hold_ms     = opts.get("hold-ms", hold_ms);
+		credits     = opts.get("credits", credits);
+	}
+};
+
 class spammer
 {
 public:
-	spammer(asio::io_context& io, const tcp::resolver::results_type& endpoints)
-		: conn_(make_shared<connection>(io, tcp::socket(io), dispatcher_))
+	spammer(asio::io_context& io, const tcp::resolver::results_type& endpoints, const client_config& config,
+		std::size_t pipeline, std::function<void()> on_done)
+		: io_(io), on_done_(std::move(on_done)), total_(config.commands), set_percent_(config.set_percent), pipeline_(pipeline), credits_(config.credits), hold_(config.hold_ms), hold_timer_(io), wheel_(io), conn_(make_shared<connection>(io, tcp::socket(io), dispatcher_, wheel_))
 	{
+		dispatcher_.on_credit = [this](uint32_t credits) {
+			granted_ += credits;
+			schedule_send();
+		};
+
+		// ответы на GET приходят в порядке запросов — время отправки берётся из начала очереди
+		dispatcher_.on_response = [this]() {
+			if(!in_flight_.empty()) {
+				latencies_.push_back(std::chrono::steady_clock::now() - in_flight_.front());
+				in_flight_.pop_front();
+			}
+			++responses_;
+			if(pipeline_ > 0) schedule_send();
+			finish_if_done();
+		};
+
+		conn_->set_backpressure_handler([this](bool congested) {
+			congested_ = congested;
+			if(!congested) schedule_send();
+		});
+
 		asio::async_connect(conn_->get_socket(), endpoints,
 			[this](error_code ec, const tcp::endpoint&)
 		{
@@ -50,20 +134,72 @@ public:
 		});
 	}
 
+	inline std::uint64_t responses() const { return responses_; }
+
+	// Задержка каждого GET: от постановки в очередь соединения до ответа
+	inline const std::vector<std::chrono::nanoseconds>& latencies() const { return latencies_; }
+	inline std::chrono::steady_clock::time_point        finished()  const { return finished_; }
+
 private:
 	void start_send_loop()
 	{
 		conn_->read(std::shared_ptr<spammer>());
+		schedule_send();
+	}
 
-		/*for(int i = 0; i < 1000; ++i)
-		{
-			conn_.send(generate_set_command());
-		}*/
-		
-		for (int i = 0; i < 1000000; ++i)
-		{
-			send_once();
+	// Команды уходят пачками: между пачками соединение успевает сериализовать
+	// очередь и сообщить о перегрузке, так что в памяти не копится весь объём
+	void schedule_send()
+	{
+		if(send_scheduled_) return;
+		send_scheduled_ = true;
+		asio::post(io_, [this]() { send_batch(); });
+	}
+
+	void send_batch()
+	{
+		send_scheduled_ = false;
+
+		batch_.clear();
+		for(; batch_.size() < SEND_BATCH && can_send(); ++sent_)
+			batch_.push_back(generate_command());
+		conn_->send_many(batch_); // вся пачка — один переход на strand
+
+		if(can_send())
+			schedule_send();
+		else
+			finish_if_done();
+	}
+
+	// Всё отправлено и на каждый GET пришёл ответ — соединение больше не нужно
+	void finish_if_done()
+	{
+		if(done_ || sent_ != total_ || responses_ != gets_sent_) return;
+
+		done_ = true;
+		finished_ = std::chrono::steady_clock::now();
+		if(hold_.count() == 0) {
+			close();
+			return;
 		}
+
+		// --hold-ms: простаивающее соединение остаётся у сервера (проверка памяти на соединение)
+		hold_timer_.expires_after(hold_);
+		hold_timer_.async_wait([this](const error_code&) { close(); });
+	}
+
+	void close()
+	{
+		conn_->close();
+		if(on_done_) on_done_();
+	}
+
+	// Без --credits ограничивает только очередь соединения; с ним — не больше выданного
+	// сервером, и до первого CREDIT ничего
+	bool can_send() const
+	{
+		return sent_ < total_ && !congested_ && (!credits_ || sent_ < granted_)
+			&& (pipeline_ == 0 || gets_sent_ - responses_ < pipeline_);
 	}
 
 	std::string generate_test(const std::string& start_string) {
@@ -72,63 +208,172 @@ private:
 		int n = dist(rng);
 		return start_string + std::to_string(n);
 	}
-	
-	std::string generate_test_key() {
-		return generate_test("testKey");
+
+	// Ключи тестовой выборки живут всё время работы: GET ссылается на них без копии
+	static const std::vector<std::string>& test_keys() {
+		static const std::vector<std::string> keys = [] {
+			std::vector<std::string> all;
+			for(int n = 1; n <= 100; ++n)
+				all.push_back("testKey" + std::to_string(n));
+			return all;
+		}();
+		return keys;
+	}
+
+	const std::string& generate_test_key() {
+		std::mt19937 rng{std::random_device{}()};
+		std::uniform_int_distribution<std::size_t> dist(0, test_keys().size() - 1);
+		return test_keys()[dist(rng)];
 	}
 
 	std::string generate_test_value() {
 		return generate_test("testValue");
 	}
 
-	base_command_ptr generate_set_command()
+	message generate_set_command()
 	{
-		std::string key = generate_test_key();
+		const std::string& key = generate_test_key();
 		all_keys_.push_back(key);
 
 		std::string value = generate_test_value();
-		return std::make_shared<set_command>(std::move(key), std::move(value));
+		return set_command{ key, std::move(value) };
 	}
 
-	base_command_ptr generate_get_command()
+	message generate_get_command()
 	{
+		++gets_sent_;
+		in_flight_.push_back(std::chrono::steady_clock::now());
 		if(all_keys_.empty()) {
-			return std::make_shared<get_command>(generate_test_key());
+			return get_command{ generate_test_key(), next_request_id() };
 		}
 		else {
 			auto index = std::rand() % all_keys_.size();
-			const auto& key = all_keys_[index];
-			return std::make_shared<get_command>(key);
+			return get_command{ all_keys_[index], next_request_id() };
 		}
 	}
 
-	base_command_ptr generate_command()
+	message generate_command()
 	{
-		bool is_set = (std::rand() % 100) == 0;
+		bool is_set = static_cast<unsigned>(std::rand() % 100) < set_percent_;
 		return is_set ? generate_set_command() : generate_get_command();
 	}
 
-	void send_once()
-	{
-		conn_->send(generate_command());
-	}
+	static constexpr std::size_t SEND_BATCH = 1024;
 
+	asio::io_context&        io_;
+	std::function<void()>    on_done_;
+	bool                     done_ = false;
+	std::size_t              total_;
+	unsigned                 set_percent_;
+	std::size_t              pipeline_;
+	bool                     credits_;
+	std::chrono::milliseconds hold_;
+	asio::steady_timer       hold_timer_;
+	std::size_t              sent_ = 0;
+	std::uint64_t            gets_sent_ = 0;    // столько ответов ждём
+	std::uint64_t            responses_ = 0;
+	std::uint64_t            granted_ = 0;      // кредитов выдано сервером за всё время
+	bool                     congested_ = false;
+	bool                     send_scheduled_ = false;
 	client_dispatcher        dispatcher_;
+	timer_wheel              wheel_;
 	connection_ptr           conn_;
-	std::vector<std::string> all_keys_;
+	std::vector<std::string_view> all_keys_;    // ключи из test_keys(), уже записанные SET
+	std::vector<message>     batch_;
+	std::deque<std::chrono::steady_clock::time_point> in_flight_; // отправленные GET без ответа
+	std::vector<std::chrono::nanoseconds>             latencies_;
+	std::chrono::steady_clock::time_point             finished_;
 };
 
-int main()
+// Перцентиль задержки в микросекундах (порядок элементов меняется)
+static std::int64_t percentile(std::vector<std::chrono::nanoseconds>& all, double p)
+{
+	const auto it = all.begin() + static_cast<std::ptrdiff_t>(p * (all.size() - 1));
+	std::nth_element(all.begin(), it, all.end());
+	return std::chrono::duration_cast<std::chrono::microseconds>(*it).count();
+}
+
+// p50 / p99 / максимум задержки по группе соединений
+static void print_latency(const std::string& label, const std::vector<std::unique_ptr<spammer>>& clients,
+	std::size_t from, std::size_t to)
+{
+	std::vector<std::chrono::nanoseconds> all;
+	for(std::size_t i = from; i < to; ++i)
+		all.insert(all.end(), clients[i]->latencies().begin(), clients[i]->latencies().end());
+	if(all.empty()) return;
+
+	const auto p50 = percentile(all, 0.50);
+	const auto p99 = percentile(all, 0.99);
+	const auto max = percentile(all, 1.0);
+	std::cout << label << ": p50 " << p50 << " us | p99 " << p99 << " us | max " << max << " us\n";
+}
+
+// Честность: разброс p99 и времени завершения между соединениями.
+// Соединение, которому сервер недодаёт времени, выделяется и тем, и другим
+static void print_fairness(const std::vector<std::unique_ptr<spammer>>& clients, std::chrono::steady_clock::time_point start)
+{
+	std::vector<std::int64_t> p99s, finish_ms;
+	for(const auto& client : clients) {
+		auto latencies = client->latencies();
+		if(latencies.empty()) continue;
+
+		p99s.push_back(percentile(latencies, 0.99));
+		finish_ms.push_back(std::chrono::duration_cast<std::chrono::milliseconds>(client->finished() - start).count());
+	}
+	if(p99s.size() < 2) return;
+
+	const auto [p99_min, p99_max] = std::minmax_element(p99s.begin(), p99s.end());
+	const auto [end_min, end_max] = std::minmax_element(finish_ms.begin(), finish_ms.end());
+	std::cout << "Fairness: p99 per connection " << *p99_min << " .. " << *p99_max << " us | finished "
+		<< *end_min << " .. " << *end_max << " ms\n";
+}
+
+int main(int argc, char* argv[])
 {
 	try {
-		asio::io_context io;
+		const client_config config{ options(argc, argv) };
+
+		std::vector<std::unique_ptr<asio::io_context>> ios;
+		for(std::size_t i = 0; i < config.threads; ++i)
+			ios.push_back(std::make_unique<asio::io_context>(1));
+
+		tcp::resolver resolver(*ios[0]);
+		auto endpoints = resolver.resolve(config.host, config.port);
 
-		tcp::resolver resolver(io);
-		auto endpoints = resolver.resolve("127.0.0.1", "9000");
+		// последнее завершившееся соединение останавливает все io_context:
+		// колесо простоя иначе держит их до своего тика
+		std::atomic<std::size_t> running{ config.connections };
+		auto on_done = [&]() {
+			if(running.fetch_sub(1) == 1)
+				for(auto& io : ios) io->stop();
+		};
 
-		spammer client(io, endpoints);
+		// соединение целиком живёт в потоке своего io_context
+		std::vector<std::unique_ptr<spammer>> clients;
+		for(std::size_t i = 0; i < config.connections; ++i)
+			clients.push_back(std::make_unique<spammer>(*ios[i % ios.size()], endpoints, config,
+				i < config.greedy ? 0 : config.pipeline, on_done));
 
-		io.run();
+		const auto start = std::chrono::steady_clock::now();
+
+		std::vector<std::thread> threads;
+		for(auto& io : ios)
+			threads.emplace_back([&io] { io->run(); });
+		for(auto& t : threads) t.join();
+
+		const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::uint64_t responses = 0;
+		for(const auto& client : clients)
+			responses += client->responses();
+
+		std::cout << "Responses: " << responses << " over " << config.connections << " connections in "
+			<< static_cast<uint64_t>(elapsed * 1000) << " ms (" << static_cast<uint64_t>(responses / elapsed) << " per second)\n";
+		print_latency("Latency", clients, 0, clients.size());
+		if(config.greedy > 0 && config.greedy < clients.size()) {
+			print_latency("Latency (greedy)", clients, 0, config.greedy);
+			print_latency("Latency (paced)", clients, config.greedy, clients.size());
+		}
+		print_fairness(clients, start);
 	}
 	catch(const std::exception& e) {
 		std::cerr << "Fatal: " << e.what() << '\n';
@@ -0,0 +1,148 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Общий пул приёмных буферов.
+// Буферы нарезаны классами размеров 16 KB, 32 KB ... 1 MB (степени двойки).
+// Соединение держит маленький буфер и берёт крупный только под большой кадр;
+// освобождённые буферы кэшируются в пуле в пределах лимита, остальное
+// возвращается системе.
+// -----------------------------------------------------------------------------
+class buffer_pool
+{
+public:
+	static constexpr size_t MIN_BUFFER_SIZE = 16 * 1024;   // 16 KB
+	static constexpr size_t MAX_BUFFER_SIZE = 1024 * 1024; // 1 MB
+	static constexpr size_t CLASS_COUNT =
+		std::countr_zero(MAX_BUFFER_SIZE) - std::countr_zero(MIN_BUFFER_SIZE) + 1;
+
+	class buffer
+	{
+	public:
+		buffer() = default;
+		buffer(buffer&& other) noexcept
+			: pool_(std::exchange(other.pool_, nullptr))
+			, data_(std::move(other.data_))
+			, size_(std::exchange(other.size_, 0)) {}
+
+		buffer& operator=(buffer&& other) noexcept
+		{
+			if(this != &other) {
+				reset();
+				pool_ = std::exchange(other.pool_, nullptr);
+				data_ = std::move(other.data_);
+				size_ = std::exchange(other.size_, 0);
+			}
+			return *this;
+		}
+
+		buffer(const buffer&) = delete;
+		buffer& operator=(const buffer&) = delete;
+
+		~buffer() { reset(); }
+
+		inline uint8_t*       data()       { return data_.get(); }
+		inline const uint8_t* data() const { return data_.get(); }
+		inline size_t         size() const { return size_; }
+
+		void reset()
+		{
+			if(pool_)
+				pool_->release(std::move(data_), size_);
+			pool_ = nullptr;
+			size_ = 0;
+		}
+
+	private:
+		friend class buffer_pool;
+
+		buffer(buffer_pool* pool, std::unique_ptr<uint8_t[]> data, size_t size)
+			: pool_(pool), data_(std::move(data)), size_(size) {}
+
+		buffer_pool*               pool_ = nullptr;
+		std::unique_ptr<uint8_t[]> data_;
+		size_t                     size_ = 0;
+	};
+
+	explicit buffer_pool(size_t max_cached_bytes = 64 * 1024 * 1024)
+		: max_cached_bytes_(max_cached_bytes) {}
+
+	static buffer_pool& instance()
+	{
+		static buffer_pool pool;
+		return pool;
+	}
+
+	// Буфер наименьшего класса, вмещающего min_size байт
+	buffer acquire(size_t min_size)
+	{
+		if(min_size > MAX_BUFFER_SIZE)
+			throw std::length_error("buffer_pool: requested size exceeds MAX_BUFFER_SIZE");
+
+		const size_t size = class_size(min_size);
+		std::unique_ptr<uint8_t[]> data;
+		{
+			std::lock_guard lock(mutex_);
+			auto& free_list = free_[class_index(size)];
+			if(!free_list.empty()) {
+				data = std::move(free_list.back());
+				free_list.pop_back();
+				cached_bytes_ -= size;
+			}
+		}
+
+		if(!data)
+			data.reset(new uint8_t[size]); // без обнуления: страницы не коммитятся заранее
+
+		in_use_bytes_.fetch_add(size, std::memory_order_relaxed);
+		return buffer(this, std::move(data), size);
+	}
+
+	static size_t class_size(size_t min_size)
+	{
+		return std::bit_ceil(std::max(min_size, MIN_BUFFER_SIZE));
+	}
+
+	inline size_t in_use_bytes() const { return in_use_bytes_.load(std::memory_order_relaxed); }
+
+	inline size_t cached_bytes() const
+	{
+		std::lock_guard lock(mutex_);
+		return cached_bytes_;
+	}
+
+private:
+	static size_t class_index(size_t size)
+	{
+		return std::countr_zero(size) - std::countr_zero(MIN_BUFFER_SIZE);
+	}
+
+	void release(std::unique_ptr<uint8_t[]> data, size_t size)
+	{
+		in_use_bytes_.fetch_sub(size, std::memory_order_relaxed);
+
+		std::lock_guard lock(mutex_);
+		if(cached_bytes_ + size > max_cached_bytes_)
+			return; // лишнее отдаём системе
+
+		free_[class_index(size)].push_back(std::move(data));
+		cached_bytes_ += size;
+	}
+
+	mutable std::mutex                                           mutex_;
+	std::array<std::vector<std::unique_ptr<uint8_t[]>>, CLASS_COUNT> free_;
+	size_t                                                       cached_bytes_ = 0;
+	const size_t                                                 max_cached_bytes_;
+	std::atomic<size_t>                                          in_use_bytes_{ 0 };
+};
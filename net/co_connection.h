@@ -0,0 +1,161 @@
+﻿#pragma once
+#include "connection.h"
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+// -----------------------------------------------------------------------------
+// Соединение на корутинах C++20. Отправка, flow_control, простой и закрытие —
+// общие с t_connection (t_connection_base), а чтение и запись — два цикла
+// co_spawn на executor_ соединения вместо цепочек обработчиков.
+// Циклы держат соединение сами, без weak_ptr::lock на каждую операцию;
+// фреймы корутин живут всё соединение, а операции ввода-вывода переиспользуют
+// память через кэш asio на поток. Писатель спит на таймере-сигнале, который
+// будит flush(); читатель при pause_reads — на таймере, который будит отбой
+// перегрузки.
+// -----------------------------------------------------------------------------
+template<class t_dispatcher, class t_executor = strand_executor>
+class t_co_connection : public t_connection_base<t_co_connection<t_dispatcher, t_executor>, t_executor>
+{
+	using base = t_connection_base<t_co_connection<t_dispatcher, t_executor>, t_executor>;
+	friend base;
+
+	using typename base::t_connection_ptr;
+	using base::shared_from_this;
+	using base::executor_;
+	using base::socket_;
+
+	// ошибки — в результат co_await, а не исключением
+	static constexpr auto use_nothrow = asio::as_tuple(asio::use_awaitable);
+
+public:
+	explicit t_co_connection(asio::io_context& io, tcp::socket sock, t_dispatcher& dispatcher, timer_wheel& wheel)
+		: base(io, std::move(sock), wheel)
+		, write_signal_(executor_)
+		, resume_signal_(executor_)
+		, dispatcher_(dispatcher)
+	{}
+
+	// Запускает циклы чтения и записи; session живёт, пока идёт чтение
+	template<class t_session_ptr>
+	void read(const t_session_ptr& session)
+	{
+		asio::co_spawn(executor_, read_loop(shared_from_this(), session), asio::detached);
+		asio::co_spawn(executor_, write_loop(shared_from_this()), asio::detached);
+	}
+
+private:
+	// self и session — владение на всё время цикла
+	template<class t_session_ptr>
+	asio::awaitable<void> read_loop(t_connection_ptr self, [[maybe_unused]] t_session_ptr session)
+	{
+		this->start_reading();
+
+		const i_socket_ptr socket = self; // диспетчеру — одно приведение на всё соединение
+
+		while(socket_.is_open()) {
+			auto [head, tail] = ring_.writable();
+			std::array<asio::mutable_buffer, 2> buffers{
+				asio::buffer(head.data(), head.size()),
+				asio::buffer(tail.data(), tail.size())
+			};
+
+			auto [ec, n] = co_await socket_.async_read_some(buffers, use_nothrow);
+			if(ec) {
+				if(ec == asio::error::eof) {
+					reading_ = false;   // пир закончил: писатель допишет очередь и закроет
+					wake_writer();
+				}
+				else if(ec != asio::error::operation_aborted) {
+					std::cerr << "Read error: " << ec.message() << '\n';
+					this->close();
+				}
+				co_return;
+			}
+
+			this->touch();
+			ring_.commit(n);
+
+			for(;;) {
+				uint32_t frames = 0;
+				if(!this->dispatch_pass(ring_, dispatcher_, socket, frames))
+					co_return;
+
+				// не читаем, пока пир не разберёт ответы; будит resume_reading()
+				while(this->reads_paused() && socket_.is_open()) {
+					resume_signal_.expires_at(asio::steady_timer::time_point::max());
+					co_await resume_signal_.async_wait(use_nothrow);
+				}
+
+				if(!socket_.is_open() || !this->budget_exhausted(frames))
+					break;
+
+				// бюджет прохода кончился: встаём в очередь executor_ за другими соединениями
+				co_await asio::post(executor_, asio::use_awaitable);
+			}
+		}
+	}
+
+	// Пишет всё, что накопилось в арене; пустая арена — сон до flush()
+	asio::awaitable<void> write_loop([[maybe_unused]] t_connection_ptr self)
+	{
+		while(socket_.is_open()) {
+			if(this->arena_.empty()) {
+				if(!reading_) {
+					this->close();
+					co_return;
+				}
+
+				writer_waiting_ = true;
+				write_signal_.expires_at(asio::steady_timer::time_point::max());
+				co_await write_signal_.async_wait(use_nothrow);
+				writer_waiting_ = false;
+				continue;
+			}
+
+			auto [ec, n] = co_await asio::async_write(socket_, this->gather_write(), use_nothrow);
+			if(ec && ec != asio::error::operation_aborted) {
+				std::cerr << "closing connection ec: " << ec.message() << '\n';
+				this->close();
+			}
+
+			if(!socket_.is_open()) {
+				this->release_write();
+				co_return;
+			}
+			if(ec) co_return;
+
+			this->complete_write();
+		}
+	}
+
+	inline void wake_writer()
+	{
+		if(writer_waiting_)
+			write_signal_.cancel();
+	}
+
+	// --- крючки t_connection_base ---
+
+	inline void start_write() { wake_writer(); }
+
+	inline void resume_reading()
+	{
+		resume_signal_.cancel();        // читатель, остановленный pause_reads, продолжит
+	}
+
+	void on_close()
+	{
+		write_signal_.cancel();         // спящие циклы увидят закрытый сокет и выйдут
+		resume_signal_.cancel();
+	}
+
+	asio::steady_timer                            write_signal_;      // cancel() — у писателя есть работа
+	asio::steady_timer                            resume_signal_;     // cancel() — перегрузка снята
+	bool                                          reading_ = true;       // false — пир закрыл свою сторону
+	bool                                          writer_waiting_ = false;
+	t_dispatcher&                                 dispatcher_;
+	ring_buffer                                   ring_;
+};
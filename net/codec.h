@@ -0,0 +1,186 @@
+﻿#pragma once
+
+#include "memory.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Статический кодек команд.
+// Команда — простая структура со списком полей:
+//
+//     static constexpr auto fields() { return std::make_tuple(&T::a, &T::b); }
+//
+// Кодирование, декодирование и размер раскрываются шаблонами на этапе
+// компиляции: без виртуальных вызовов и без кучи на каждую команду.
+// Строка на проводе — std::string (владеет байтами) или std::string_view:
+// при декодировании она ссылается прямо в принятый кадр и живёт, пока жив кадр.
+// Размер делится на статическую часть (фиксированные поля и префиксы длин,
+// считается constexpr) и динамическую (байты строк, элементы векторов).
+// -----------------------------------------------------------------------------
+namespace codec
+{
+	template<class T>
+	concept record = requires { T::fields(); };
+
+	template<class T>
+	concept scalar = std::is_arithmetic_v<T> || std::is_enum_v<T>;
+
+	template<class T>
+	concept text = std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>;
+
+	template<class T>
+	struct is_vector : std::false_type {};
+
+	template<class E>
+	struct is_vector<std::vector<E>> : std::true_type {};
+
+	template<class T>
+	struct is_pair : std::false_type {};
+
+	template<class A, class B>
+	struct is_pair<std::pair<A, B>> : std::true_type {};
+
+	template<class T, class M>
+	using member_t = std::remove_cvref_t<decltype(std::declval<const T&>().*std::declval<M>())>;
+
+	// --- статическая часть размера ---
+
+	template<class T>
+	constexpr size_t static_size();
+
+	template<record T>
+	constexpr size_t record_static_size()
+	{
+		return std::apply([](auto... member) {
+			return (size_t{ 0 } + ... + static_size<member_t<T, decltype(member)>>());
+		}, T::fields());
+	}
+
+	template<class T>
+	constexpr size_t static_size()
+	{
+		if constexpr(scalar<T>)
+			return sizeof(T);
+		else if constexpr(text<T> || is_vector<T>::value)
+			return sizeof(uint32_t); // префикс длины
+		else if constexpr(is_pair<T>::value)
+			return static_size<typename T::first_type>() + static_size<typename T::second_type>();
+		else
+			return record_static_size<T>();
+	}
+
+	// --- динамическая часть размера ---
+
+	template<class T>
+	size_t dynamic_size(const T& value)
+	{
+		if constexpr(scalar<T>) {
+			return 0;
+		}
+		else if constexpr(text<T>) {
+			return value.size();
+		}
+		else if constexpr(is_vector<T>::value) {
+			size_t size = value.size() * static_size<typename T::value_type>();
+			for(const auto& item : value)
+				size += dynamic_size(item);
+			return size;
+		}
+		else if constexpr(is_pair<T>::value) {
+			return dynamic_size(value.first) + dynamic_size(value.second);
+		}
+		else {
+			return std::apply([&](auto... member) {
+				return (size_t{ 0 } + ... + dynamic_size(value.*member));
+			}, T::fields());
+		}
+	}
+
+	template<class T>
+	inline size_t size(const T& value)
+	{
+		return static_size<T>() + dynamic_size(value);
+	}
+
+	// --- кодирование ---
+
+	template<class T>
+	void encode(memory_writer& writer, const T& value)
+	{
+		if constexpr(scalar<T> || text<T>) {
+			writer.write(value);
+		}
+		else if constexpr(is_vector<T>::value) {
+			if(value.size() > std::numeric_limits<uint32_t>::max())
+				throw std::runtime_error("vector too long to serialize");
+			writer.write(static_cast<uint32_t>(value.size()));
+			for(const auto& item : value)
+				encode(writer, item);
+		}
+		else if constexpr(is_pair<T>::value) {
+			encode(writer, value.first);
+			encode(writer, value.second);
+		}
+		else {
+			std::apply([&](auto... member) { (encode(writer, value.*member), ...); }, T::fields());
+		}
+	}
+
+	// --- декодирование ---
+
+	template<class T>
+	void decode(memory_reader& reader, T& value)
+	{
+		if constexpr(scalar<T> || text<T>) {
+			reader.read(value);
+		}
+		else if constexpr(is_vector<T>::value) {
+			uint32_t count;
+			reader.read(count);
+			// каждый элемент занимает хотя бы свою статическую часть —
+			// заведомо лживый счётчик отсекается до резервирования памяти
+			if(count > reader.size() / static_size<typename T::value_type>())
+				throw std::runtime_error("vector count exceeds frame size");
+
+			value.resize(count);
+			for(auto& item : value)
+				decode(reader, item);
+		}
+		else if constexpr(is_pair<T>::value) {
+			decode(reader, value.first);
+			decode(reader, value.second);
+		}
+		else {
+			std::apply([&](auto... member) { (decode(reader, value.*member), ...); }, T::fields());
+			if constexpr(requires { value.validate(); })
+				value.validate();
+		}
+	}
+
+	// --- кадр: [uint32 size][uint8 type][поля] ---
+
+	constexpr size_t FRAME_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint8_t);
+
+	template<record T>
+	inline size_t frame_size(const T& cmd)
+	{
+		return FRAME_HEADER_SIZE + size(cmd);
+	}
+
+	template<record T>
+	void encode_frame(memory_writer& writer, const T& cmd)
+	{
+		writer.write(static_cast<uint32_t>(frame_size(cmd)));
+		writer.write(static_cast<uint8_t>(T::type));
+		encode(writer, cmd);
+	}
+}
@@ -1,55 +1,205 @@
 ﻿#pragma once
 #include "protocol.h"
+#include "ring_buffer.h"
+#include "output_arena.h"
+#include "timer_wheel.h"
 #include <boost/asio.hpp>
 #include <iostream>
-#include <queue>
+#include <span>
 #include <cstring>
 #include <limits>
+#include <functional>
+#include <type_traits>
 
 namespace asio = boost::asio;
 using boost::system::error_code;
 using tcp = asio::ip::tcp;
 
-constexpr size_t MAX_MESSAGE_SIZE = 1024 * 1024; // 1 MB
 constexpr size_t MSG_SIZE_BYTES = 4;
-constexpr size_t BUFFER_SIZE = 4 * 1024 * 1024; // 4 MB
+constexpr size_t MAX_WRITE_BUFFERS = 64;         // буферов в одном writev
+constexpr size_t MAX_WRITE_BYTES = 256 * 1024;   // 256 KB за один async_write
+constexpr std::chrono::seconds DEFAULT_IDLE_TIMEOUT{ 30 };
+constexpr std::chrono::seconds IDLE_TRIM_DELAY{ 1 };       // столько без активности — выходной буфер в пул
+constexpr uint32_t DEFAULT_READ_BUDGET = 64;       // кадров за проход разбора на сервере
+
+// Ограничение исходящей очереди соединения.
+// Выше high_watermark соединение считается перегруженным: продюсер получает
+// сигнал через backpressure-обработчик, а при pause_reads ещё и перестаёт
+// читаться сокет (пир упирается в TCP-окно). Ниже low_watermark — отбой.
+struct flow_control
+{
+	size_t   low_watermark  = 1024 * 1024;     // 1 MB
+	size_t   high_watermark = 4 * 1024 * 1024; // 4 MB
+	bool     pause_reads    = false;
+	uint32_t credit_window  = 0;               // > 0 — выдавать пиру кредиты (CREDIT) на столько кадров
+	uint32_t read_budget    = 0;               // > 0 — кадров за проход разбора, остальные — после других соединений
+};
+
+// Исполнитель соединения. strand — когда io_context крутят несколько потоков
+// и обработчики одного соединения надо сериализовать; голый executor
+// io_context — когда поток у io_context один (thread-per-core) и порядок
+// обеспечен им самим: ни очереди strand, ни межпоточной синхронизации.
+using strand_executor = asio::strand<asio::io_context::executor_type>;
+using inline_executor = asio::io_context::executor_type;
 
+template<class t_executor>
+t_executor make_connection_executor(asio::io_context& io)
+{
+	if constexpr(std::is_same_v<t_executor, inline_executor>)
+		return io.get_executor();
+	else
+		return asio::make_strand(io.get_executor());
+}
+
+// Разбирает целые кадры из кольца (не больше max_frames, 0 — все) и отдаёт их
+// диспетчеру. Кадр читается прямо из кольца, без копии (на стыке — двумя сегментами).
+// false — ошибка протокола (уже выведена), соединение надо закрыть
 template<class t_dispatcher>
-class t_connection : public i_socket, public std::enable_shared_from_this<t_connection<t_dispatcher>>
+bool dispatch_frames(ring_buffer& ring, t_dispatcher& dispatcher, const i_socket_ptr& socket, uint32_t& frames,
+	uint32_t max_frames = 0)
 {
-	using std::enable_shared_from_this<t_connection<t_dispatcher>>::shared_from_this;
-	using t_connection_weak_ptr = std::weak_ptr<t_connection<t_dispatcher>>;
+	while((max_frames == 0 || frames < max_frames) && ring.size() >= MSG_SIZE_BYTES) {
+		uint32_t msg_size = 0;
+		ring.peek(&msg_size, MSG_SIZE_BYTES);
 
-public:
-	explicit t_connection(asio::io_context& io, tcp::socket sock, t_dispatcher& dispatcher)
-		: socket_(std::move(sock))
-		, dispatcher_(dispatcher)
-		, idle_timer_(io)
-		, io_(io)
-		, strand_(asio::make_strand(io.get_executor()))
+		if(msg_size < MSG_SIZE_BYTES || msg_size > MAX_MESSAGE_SIZE) {
+			std::cerr << "Invalid message size: " << msg_size << std::endl;
+			return false;
+		}
+
+		if(ring.size() < msg_size) {
+			if(msg_size > ring.capacity())
+				ring.resize(msg_size); // кадр больше буфера — берём класс побольше
+			break;
+		}
+
+		auto [first, second] = ring.readable(MSG_SIZE_BYTES, msg_size - MSG_SIZE_BYTES);
+
+		try {
+			::read(memory_reader{ first, second }, dispatcher, socket);
+		}
+		catch(const std::exception& e) {
+			std::cerr << "Read Error: " << e.what() << std::endl;
+			return false;
+		}
+
+		ring.consume(msg_size);
+		++frames;
+	}
+
+	if(ring.empty())
+		ring.resize(buffer_pool::MIN_BUFFER_SIZE); // всё разобрано — отдаём крупный буфер
+
+	return true;
+}
+
+// Кадров в кольце, считая начатый, но ещё не дошедший целиком; счёт — не больше limit + 1
+inline uint32_t frames_in_ring(const ring_buffer& ring, uint32_t limit)
+{
+	uint32_t count = 0;
+	size_t offset = 0;
+	while(offset < ring.size() && count <= limit) {
+		++count;
+		if(ring.size() - offset < MSG_SIZE_BYTES) break;   // начат даже заголовок — кадр уже в пути
+
+		uint32_t msg_size = 0;
+		ring.peek(&msg_size, MSG_SIZE_BYTES, offset);
+		offset += std::max<size_t>(msg_size, MSG_SIZE_BYTES);
+	}
+	return count;
+}
+
+// -----------------------------------------------------------------------------
+// Общая часть соединений (t_connection, t_co_connection): исходящая арена и
+// отправка, flow_control, простой через timer_wheel, закрытие.
+// t_derived — CRTP-наследник, он же владеет чтением и решает, как писать:
+//     void start_write();    // в арене есть данные, запись не идёт
+//     void resume_reading(); // перегрузка снята, чтение стояло из-за pause_reads
+//     void on_close();       // сокет закрыт — отпустить свои ожидания
+// -----------------------------------------------------------------------------
+template<class t_derived, class t_executor>
+class t_connection_base : public i_socket, public i_idle_watch, public std::enable_shared_from_this<t_derived>
+{
+protected:
+	using std::enable_shared_from_this<t_derived>::shared_from_this;
+	using t_connection_ptr      = std::shared_ptr<t_derived>;
+	using t_connection_weak_ptr = std::weak_ptr<t_derived>;
+
+	static constexpr timer_wheel::tick_t CLOSED = std::numeric_limits<timer_wheel::tick_t>::max();
+
+	t_connection_base(asio::io_context& io, tcp::socket sock, timer_wheel& wheel)
+		: executor_(make_connection_executor<t_executor>(io))
+		, socket_(std::move(sock))
+		, wheel_(wheel)
+		, idle_timeout_(DEFAULT_IDLE_TIMEOUT)
 	{}
 
-	~t_connection() override
+public:
+	~t_connection_base() override
 	{
-		std::cout << "Connection closed\n";
+		std::cout << "Connection closed (sent " << frames_sent_ << " frames in "
+			<< writes_issued_ << " writes, " << read_yields_ << " read yields)\n";
 	}
 
-	void send(const base_command_ptr& cmd) override
+	void send(const message& msg) override
 	{
-		t_connection_weak_ptr self_weak = shared_from_this();
+		// Ответ диспетчера из цикла разбора: мы уже на executor_ — сразу в арену,
+		// а запись одна на весь проход (см. конец прохода чтения)
+		if(executor_.running_in_this_thread() && in_read_pass_) {
+			enqueue(msg);
+			return;
+		}
 
-		asio::post(strand_, [self_weak, cmd]() {
-			auto self = self_weak.lock();
-			if(!self || !self->socket_.is_open()) return;
+		post_encoded(std::span<const message>(&msg, 1));
+	}
 
-			self->reset_idle_timer();
+	void send_many(std::span<const message> msgs) override
+	{
+		if(msgs.empty()) return;
 
-			bool write_in_progress = !self->send_queue_.empty();
-			self->send_queue_.push(cmd->serialize().get_buffer());
-			if(!write_in_progress) {
-				self->do_write();
-			}
-		});
+		if(executor_.running_in_this_thread() && in_read_pass_) {
+			for(const auto& msg : msgs)
+				enqueue(msg);
+			return;
+		}
+
+		post_encoded(msgs);
+	}
+
+	void send(const prepared_get_response& frame, uint16_t request_id, uint64_t reads, uint64_t writes) override
+	{
+		if(executor_.running_in_this_thread() && in_read_pass_) {
+			enqueue_prepared(frame, request_id, reads, writes);
+			return;
+		}
+
+		// кадр живёт, пока вызывающий в эпохе: на executor_ уходит копия
+		if(frame.size() > MAX_MESSAGE_SIZE) {
+			std::cerr << "Message too large to send: " << frame.size() << '\n';
+			return;
+		}
+
+		std::vector<uint8_t> bytes(frame.size());
+		frame.write(bytes, request_id, reads, writes);
+		post_frames(std::move(bytes));
+	}
+
+	// Настраивать до read(): поля читаются на executor_ без синхронизации
+	void set_flow_control(const flow_control& flow)
+	{
+		flow_ = flow;
+	}
+
+	// Настраивать до read(); 0 — не закрывать по простою
+	void set_idle_timeout(std::chrono::milliseconds timeout)
+	{
+		idle_timeout_ = std::max(timeout, std::chrono::milliseconds::zero());
+	}
+
+	// Вызывается на executor_: true — очередь выше high_watermark, false — опустилась ниже low
+	void set_backpressure_handler(std::function<void(bool)> handler)
+	{
+		on_backpressure_ = std::move(handler);
 	}
 
 	void close()
@@ -60,56 +210,339 @@ public:
 		socket_.cancel(ec);
 		socket_.shutdown(tcp::socket::shutdown_both, ec);
 		socket_.close(ec);
-		idle_timer_.cancel();
+		last_activity_.store(CLOSED, std::memory_order_relaxed); // колесо забудет соединение
 
-		send_queue_ = {};
+		// байты идущей записи отдаёт её обработчик (release_write), а не закрытие
+		if(in_flight_ == 0)
+			arena_.clear();
+		derived().on_close();
 	}
 
 	inline tcp::socket& get_socket() { return socket_; }
 
-	template<class t_session_ptr>
-	void read(const t_session_ptr& session)
+protected:
+	inline t_derived& derived() { return static_cast<t_derived&>(*this); }
+
+	// Активность — только отметка тика; простой отслеживает общее timer_wheel
+	inline void touch()
+	{
+		last_activity_.store(wheel_.now(), std::memory_order_relaxed);
+		trimmed_.store(false, std::memory_order_relaxed);
+	}
+
+	// Начало чтения: слежение за простоем и начальное окно кредитов
+	void start_reading()
+	{
+		touch();
+		wheel_.watch(shared_from_this(), idle_deadline()); // и без idle_timeout: простой возвращает буферы
+
+		if(flow_.credit_window > 0) {
+			// начальное окно: столько кадров пир может прислать, не дожидаясь ответа
+			enqueue_frame(credit_command{ flow_.credit_window });
+			flush();
+		}
+	}
+
+	// Проход разбора: кадры из кольца — диспетчеру, ответы — в арену, затем одна запись.
+	// false — ошибка протокола, соединение уже закрыто
+	template<class t_dispatcher>
+	bool dispatch_pass(ring_buffer& ring, t_dispatcher& dispatcher, const i_socket_ptr& socket, uint32_t& frames)
 	{
-		//if(!session) return;
+		// с кредитами за проход — не больше окна: всё сверх него пир прислал без кредита
+		uint32_t max_frames = flow_.read_budget;
+		if(flow_.credit_window > 0 && (max_frames == 0 || max_frames > flow_.credit_window))
+			max_frames = flow_.credit_window;
+
+		in_read_pass_ = true;
+		const bool ok = dispatch_frames(ring, dispatcher, socket, frames, max_frames);
+		in_read_pass_ = false;
+
+		if(!ok) {
+			close();
+			return false;
+		}
+
+		if(flow_.credit_window > 0) {
+			// кредиты за этот проход пир ещё не видел: разобранное сейчас и всё, что
+			// лежит в кольце, он прислал под прежние — их не больше окна
+			if(frames + frames_in_ring(ring, flow_.credit_window) > flow_.credit_window) {
+				std::cerr << "Peer exceeded its credit window of " << flow_.credit_window << " frames, closing connection\n";
+				close();
+				return false;
+			}
+			if(frames > 0)
+				enqueue_frame(credit_command{ frames }); // возвращаем кредиты за разобранные кадры
+		}
+
+		flush(); // всё, что диспетчер ответил за проход, — одной записью
+		return true;
+	}
 
+	// true — проход прерван бюджетом, в кольце могут остаться целые кадры
+	inline bool budget_exhausted(uint32_t frames)
+	{
+		if(flow_.read_budget == 0 || frames < flow_.read_budget)
+			return false;
+		++read_yields_;
+		return true;
+	}
+
+	inline bool reads_paused() const { return congested_ && flow_.pause_reads; }
+
+	void enqueue(const message& msg)
+	{
+		std::visit([this](const auto& cmd) { enqueue_frame(cmd); }, msg);
+	}
+
+	// Кадр сериализуется один раз, сразу в арену, ровно под свой размер
+	template<class T>
+	void enqueue_frame(const T& cmd)
+	{
+		const size_t size = codec::frame_size(cmd);
+		if(size > MAX_MESSAGE_SIZE) {
+			std::cerr << "Message too large to send: " << size << '\n';
+			return;
+		}
+
+		memory_writer writer{ arena_.allocate(size) };
+		codec::encode_frame(writer, cmd);
+		++frames_sent_;
+
+		update_backpressure();
+	}
+
+	// Команды чужого потока сериализуются сразу, в потоке вызывающего: их поля могут
+	// ссылаться на его память (string_view). На executor_ уходят готовые кадры подряд
+	void post_encoded(std::span<const message> msgs)
+	{
+		std::vector<uint8_t> frames;
+		for(const auto& msg : msgs) {
+			std::visit([&frames](const auto& cmd) {
+				const size_t size = codec::frame_size(cmd);
+				if(size > MAX_MESSAGE_SIZE) {
+					std::cerr << "Message too large to send: " << size << '\n';
+					return;
+				}
+
+				const size_t offset = frames.size();
+				frames.resize(offset + size);
+				memory_writer writer{ std::span<uint8_t>(frames).subspan(offset) };
+				codec::encode_frame(writer, cmd);
+			}, msg);
+		}
+		if(!frames.empty())
+			post_frames(std::move(frames));
+	}
+
+	void post_frames(std::vector<uint8_t> frames)
+	{
 		t_connection_weak_ptr self_weak = shared_from_this();
 
-		asio::post(strand_, [self_weak, session]() {
+		asio::post(executor_, [self_weak, frames = std::move(frames)]() {
 			auto self = self_weak.lock();
-			if(!self) return;
+			if(!self || !self->socket_.is_open()) return;
 
-			self->template do_read<t_session_ptr>(session);
+			self->touch();
+
+			self->enqueue_encoded(frames);
+			self->flush();
+		});
+	}
+
+	// Кадры из post_frames: каждый — своим куском арены, как из enqueue_frame
+	void enqueue_encoded(std::span<const uint8_t> frames)
+	{
+		while(!frames.empty()) {
+			uint32_t size;
+			std::memcpy(&size, frames.data(), sizeof(size));
+
+			std::memcpy(arena_.allocate(size).data(), frames.data(), size);
+			frames = frames.subspan(size);
+			++frames_sent_;
+
+			update_backpressure();
+		}
+	}
+
+	void enqueue_prepared(const prepared_get_response& frame, uint16_t request_id, uint64_t reads, uint64_t writes)
+	{
+		if(frame.size() > MAX_MESSAGE_SIZE) {
+			std::cerr << "Message too large to send: " << frame.size() << '\n';
+			return;
+		}
+
+		frame.write(arena_.allocate(frame.size()), request_id, reads, writes);
+		++frames_sent_;
+
+		update_backpressure();
+	}
+
+	void flush()
+	{
+		if(in_flight_ == 0 && !arena_.empty())
+			derived().start_write();
+	}
+
+	// Собирает всё, что накопилось в арене (в пределах лимитов), в write_buffers_ для одного writev.
+	// Отправляемые байты остаются на месте до complete_write()
+	std::span<const asio::const_buffer> gather_write()
+	{
+		write_buffers_.clear();
+		in_flight_ = arena_.gather(MAX_WRITE_BUFFERS, MAX_WRITE_BYTES, [this](std::span<const uint8_t> data) {
+			write_buffers_.emplace_back(data.data(), data.size());
 		});
+		++writes_issued_;
+		touch();
+
+		// span, а не сам вектор: asio хранит копию последовательности буферов
+		return write_buffers_;
+	}
+
+	// Обработчик записи на закрытом сокете: её байты больше никто не читает
+	void release_write()
+	{
+		in_flight_ = 0;
+		arena_.clear();
+	}
+
+	void complete_write()
+	{
+		arena_.consume(in_flight_);
+		in_flight_ = 0;
+		touch(); // пир принял данные — тоже активность
+		update_backpressure();
+	}
+
+	// Простой: выходной чанк — в пул. Приёмное кольцо к этому времени уже
+	// минимального класса (см. dispatch_frames), и в него ждёт чтение — его не трогаем
+	void trim_idle()
+	{
+		trimmed_.store(true, std::memory_order_relaxed);
+		if(in_flight_ == 0)
+			arena_.trim();
 	}
 
+	void update_backpressure()
+	{
+		if(!congested_ && arena_.size() >= flow_.high_watermark) {
+			congested_ = true;
+			if(on_backpressure_) on_backpressure_(true);
+		}
+		else if(congested_ && arena_.size() <= flow_.low_watermark) {
+			congested_ = false;
+			if(on_backpressure_) on_backpressure_(false);
+
+			derived().resume_reading();
+		}
+	}
+
+	t_executor                                    executor_;          // strand или executor io_context (см. выше)
+	output_arena                                  arena_;
+	std::vector<asio::const_buffer>               write_buffers_;
+	std::size_t                                   in_flight_ = 0;     // байт в текущем async_write
+	std::uint64_t                                 frames_sent_ = 0;
+	std::uint64_t                                 writes_issued_ = 0;
+	std::uint64_t                                 read_yields_ = 0;   // проходов, прерванных бюджетом
+	flow_control                                  flow_;
+	bool                                          congested_ = false;
+	bool                                          in_read_pass_ = false; // идёт разбор кадров на executor_
+	std::function<void(bool)>                     on_backpressure_;
+	tcp::socket                                   socket_;
+	timer_wheel&                                  wheel_;
+	std::chrono::milliseconds                     idle_timeout_;
+	std::atomic<timer_wheel::tick_t>              last_activity_{ 0 };
+	std::atomic<bool>                             trimmed_{ false };  // буферы отданы после последней активности
+
 private:
-	void reset_idle_timer() {
-		t_connection_weak_ptr self_weak = shared_from_this();
+	// Срок закрытия по простою; CLOSED — не закрывать
+	timer_wheel::tick_t close_deadline(timer_wheel::tick_t last) const
+	{
+		return idle_timeout_.count() == 0 ? CLOSED : last + wheel_.to_ticks(idle_timeout_);
+	}
 
-		idle_timer_.cancel();
-		idle_timer_.expires_after(std::chrono::seconds(30));
+	// Ближайшее из: отдать буферы, закрыть. Уже отдавшее буферы соединение
+	// колесо навещает раз в IDLE_TRIM_DELAY — заметить новую активность
+	timer_wheel::tick_t idle_deadline() const override
+	{
+		const auto last = last_activity_.load(std::memory_order_relaxed);
+		if(last == CLOSED) return 0;
 
-		idle_timer_.async_wait([self_weak](const error_code& ec) {
+		const auto trim = wheel_.to_ticks(IDLE_TRIM_DELAY);
+		const auto next = trimmed_.load(std::memory_order_relaxed) ? wheel_.now() + trim : last + trim;
+		return std::min(close_deadline(last), next);
+	}
+
+	// Колесо забывает сработавшее соединение: оно либо закрывается, либо встаёт на новый срок
+	void on_idle() override
+	{
+		t_connection_weak_ptr self_weak = shared_from_this();
+
+		asio::post(executor_, [self_weak]() {
 			auto self = self_weak.lock();
-			if(!self || ec == asio::error::operation_aborted) return;
+			if(!self || !self->socket_.is_open()) return;
 
-			if(!ec) {
-				std::cout << "Nothing happened for 30 seconds, closing connection\n";
-				asio::post(self->strand_, [self]() { self->close(); });
+			const auto now = self->wheel_.now();
+			const auto last = self->last_activity_.load(std::memory_order_relaxed);
+			if(self->close_deadline(last) <= now) {
+				std::cout << "Nothing happened for " << self->idle_timeout_.count() << " ms, closing connection\n";
+				self->close();
+				return;
 			}
+
+			if(!self->trimmed_.load(std::memory_order_relaxed) && last + self->wheel_.to_ticks(IDLE_TRIM_DELAY) <= now)
+				self->trim_idle();
+			self->wheel_.watch(self, self->idle_deadline());
+		});
+	}
+};
+
+template<class t_dispatcher, class t_executor = strand_executor>
+class t_connection : public t_connection_base<t_connection<t_dispatcher, t_executor>, t_executor>
+{
+	using base = t_connection_base<t_connection<t_dispatcher, t_executor>, t_executor>;
+	friend base;
+
+	using typename base::t_connection_weak_ptr;
+	using base::shared_from_this;
+	using base::executor_;
+	using base::socket_;
+
+public:
+	explicit t_connection(asio::io_context& io, tcp::socket sock, t_dispatcher& dispatcher, timer_wheel& wheel)
+		: base(io, std::move(sock), wheel)
+		, dispatcher_(dispatcher)
+	{}
+
+	template<class t_session_ptr>
+	void read(const t_session_ptr& session)
+	{
+		t_connection_weak_ptr self_weak = shared_from_this();
+
+		asio::post(executor_, [self_weak, session]() {
+			auto self = self_weak.lock();
+			if(!self) return;
+
+			self->start_reading();
+			self->template do_read<t_session_ptr>(session);
 		});
 	}
 
+private:
 	template<class t_session_ptr>
 	void do_read(const t_session_ptr& session)
 	{
 		if(!socket_.is_open()) return;
 
-		reset_idle_timer();
+		this->touch();
 		t_connection_weak_ptr self_weak = shared_from_this();
 
-		socket_.async_read_some(
-			asio::buffer(buffer_.data() + unparsed_bytes_, buffer_.size() - unparsed_bytes_),
+		auto [head, tail] = ring_.writable();
+		std::array<asio::mutable_buffer, 2> buffers{
+			asio::buffer(head.data(), head.size()),
+			asio::buffer(tail.data(), tail.size())
+		};
+
+		socket_.async_read_some(buffers, asio::bind_executor(executor_,
 			[self_weak, session](error_code ec, std::size_t n)
 		{
 			auto self = self_weak.lock();
@@ -117,97 +550,93 @@ private:
 
 			if(!ec)
 			{
-				size_t offset = 0;
-				n += self->unparsed_bytes_;
-
-				while(n - offset >= MSG_SIZE_BYTES) {
-					uint32_t msg_size = 0;
-					std::memcpy(&msg_size, self->buffer_.data() + offset, MSG_SIZE_BYTES);
-
-					if(msg_size < MSG_SIZE_BYTES || msg_size > MAX_MESSAGE_SIZE) {
-						std::cerr << "Invalid message size: " << msg_size << std::endl;
-						asio::post(self->strand_, [self]() { self->close(); });
-						return;
-					}
-
-					if(n - offset < msg_size) break;
-
-					std::vector<uint8_t> message(
-						self->buffer_.begin() + offset + MSG_SIZE_BYTES,
-						self->buffer_.begin() + offset + msg_size
-					);
-
-					try {
-						::read(message, self->dispatcher_, self);
-					}
-					catch(const std::exception& e) {
-						std::cerr << "Read Error: " << e.what() << std::endl;
-						asio::post(self->strand_, [self]() { self->close(); });
-						return;
-					}
-
-					offset += msg_size;
-				}
-
-				if(offset < n) {
-					std::memmove(self->buffer_.data(), self->buffer_.data() + offset, n - offset);
-					self->unparsed_bytes_ = n - offset;
-				}
-				else {
-					self->unparsed_bytes_ = 0;
-				}
-
-				self->template do_read<t_session_ptr>(session);
+				self->ring_.commit(n);
+				self->template read_pass<t_session_ptr>(session);
 			}
 			else if(ec != asio::error::eof)
 			{
 				std::cerr << "Read error: " << ec.message() << '\n';
-				asio::post(self->strand_, [self]() { self->close(); });
+				self->close();
 			}
-		});
+		}));
 	}
 
-	void send_next()
+	// Проход разбора, затем чтение сокета; если кончился бюджет прохода — повтор
+	// через очередь executor_: готовые обработчики других соединений этого потока идут раньше
+	template<class t_session_ptr>
+	void read_pass(const t_session_ptr& session)
 	{
-		send_queue_.pop();
-		if(!send_queue_.empty()) {
-			do_write();
+		if(!socket_.is_open()) return;
+
+		auto self = shared_from_this();
+		t_connection_weak_ptr self_weak = self;
+		uint32_t frames = 0;
+
+		if(!this->dispatch_pass(ring_, dispatcher_, self, frames))
+			return;
+
+		if(this->reads_paused()) {
+			// не читаем, пока пир не разберёт ответы; продолжим из resume_reading()
+			resume_read_ = [self_weak, session]() {
+				if(auto self = self_weak.lock())
+					self->template read_pass<t_session_ptr>(session);
+			};
+			return;
+		}
+
+		if(this->budget_exhausted(frames)) {
+			asio::post(executor_, [self_weak, session]() {
+				if(auto self = self_weak.lock())
+					self->template read_pass<t_session_ptr>(session);
+			});
+			return;
 		}
+
+		do_read(session);
 	}
 
-	void do_write() {
-		auto data = send_queue_.front();
-		auto data_ptr = std::make_shared<std::vector<uint8_t>>(std::move(data));
+	// --- крючки t_connection_base ---
 
+	void start_write()
+	{
+		const auto buffers = this->gather_write();
 		t_connection_weak_ptr self_weak = shared_from_this();
-		reset_idle_timer();
 
-		asio::async_write(socket_, asio::buffer(*data_ptr),
-			[self_weak, data_ptr](error_code ec, std::size_t /*length*/)
+		asio::async_write(socket_, buffers,
+			asio::bind_executor(executor_, [self_weak](error_code ec, std::size_t /*length*/)
 		{
 			auto self = self_weak.lock();
 			if(!self) return;
 
-			if(ec == asio::error::operation_aborted) return;
-
-			if(ec)
+			if(ec && ec != asio::error::operation_aborted)
 			{
 				std::cerr << "closing connection ec: " << ec.message() << '\n';
-				asio::post(self->strand_, [self]() { self->close(); });
+				self->close();
+			}
+
+			if(!self->socket_.is_open()) {
+				self->release_write();
 				return;
 			}
+			if(ec) return;
 
-			asio::post(self->strand_, [self]() { self->send_next(); });
-		});
+			self->complete_write();
+			self->flush();
+		}));
 	}
 
-private:
-	std::queue<std::vector<uint8_t>>              send_queue_;
-	tcp::socket                                   socket_;
-	std::array<std::uint8_t, BUFFER_SIZE>         buffer_{};
+	void resume_reading()
+	{
+		if(auto resume = std::exchange(resume_read_, nullptr))
+			resume();
+	}
+
+	void on_close()
+	{
+		resume_read_ = nullptr;
+	}
+
+	std::function<void()>                         resume_read_;       // отложенное чтение при pause_reads
 	t_dispatcher&                                 dispatcher_;
-	std::size_t                                   unparsed_bytes_ = 0;
-	asio::steady_timer                            idle_timer_;
-	asio::io_context&                             io_;
-	asio::strand<asio::io_context::executor_type> strand_;
+	ring_buffer                                   ring_;
 };
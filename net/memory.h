@@ -1,62 +1,117 @@
 ﻿#pragma once
 
 #include <vector>
+#include <span>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <cstring>
 #include <type_traits>
 #include <limits>
 
+// Пишет кадр в заранее выделенную область ровно под get_serialized_size():
+// без промежуточных векторов и без переаллокаций.
 class memory_writer {
 public:
-	memory_writer() = default;
-	explicit memory_writer(std::vector<uint8_t>&& buffer) : buffer_(std::move(buffer)) {}
+	explicit memory_writer(std::span<uint8_t> buffer) : buffer_(buffer), offset_(0) {}
 
-	void write(const std::string& str) {
+	inline void write(const std::string& str) {
+		write(std::string_view(str));
+	}
+
+	void write(std::string_view str) {
 		if(str.size() > std::numeric_limits<uint32_t>::max()) {
 			throw std::runtime_error("string too long to serialize");
 		}
 		uint32_t len = static_cast<uint32_t>(str.size());
 		write(len);
-		buffer_.insert(buffer_.end(), str.begin(), str.end());
+		put(str.data(), str.size());
 	}
 
 	template<typename T>
 	void write(const T& value) {
 		static_assert(std::is_trivially_copyable_v<T>, "Type must be trivially copyable");
-		const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&value);
-		buffer_.insert(buffer_.end(), ptr, ptr + sizeof(T));
+		put(&value, sizeof(T));
 	}
 
-	inline const std::vector<uint8_t>& get_buffer() const {
-		return buffer_;
+	inline size_t size() const {
+		return offset_;
 	}
 
 private:
-	std::vector<uint8_t> buffer_;
+	void put(const void* src, size_t len) {
+		if(len > buffer_.size() - offset_) {
+			throw std::runtime_error("write out of bounds");
+		}
+		std::memcpy(buffer_.data() + offset_, src, len);
+		offset_ += len;
+	}
+
+	std::span<uint8_t> buffer_;
+	size_t offset_;
 };
 
+// Читает поля прямо из принятого кадра (без промежуточной копии в вектор).
+// Кадр может лежать двумя сегментами (кадр на стыке кольцевого буфера).
+// Владельцем памяти остаётся вызывающий — reader валиден, пока жив кадр.
+// read(std::string_view&) не копирует: строка ссылается прямо в кадр.
+// Стык сегментов один, поэтому пересечь его может не больше одного поля —
+// только его байты собираются в scratch_ (строка тогда живёт, пока жив reader).
 class memory_reader {
 public:
-	explicit memory_reader(const std::vector<uint8_t>& buffer) : buffer_(buffer), offset_(0) {}
+	explicit memory_reader(std::span<const uint8_t> first, std::span<const uint8_t> second = {})
+		: first_(first), second_(second), offset_(0) {}
 
 	void read(std::string& value) {
 		uint32_t len;
 		read(len);
-		if(offset_ + len > buffer_.size()) {
+		if(len > size()) {
+			throw std::runtime_error("string read out of bounds");
+		}
+		if(offset_ + len <= first_.size()) {
+			value.assign(reinterpret_cast<const char*>(first_.data() + offset_), len);
+			offset_ += len;
+		}
+		else {
+			value.resize(len);
+			copy(value.data(), len);
+		}
+	}
+
+	void read(std::string_view& value) {
+		uint32_t len;
+		read(len);
+		if(len > size()) {
 			throw std::runtime_error("string read out of bounds");
 		}
-		value = std::string(reinterpret_cast<const char*>(buffer_.data() + offset_), len);
+		if(offset_ + len <= first_.size()) {
+			value = std::string_view(reinterpret_cast<const char*>(first_.data() + offset_), len);
+		}
+		else if(offset_ >= first_.size()) {
+			value = std::string_view(reinterpret_cast<const char*>(second_.data() + (offset_ - first_.size())), len);
+		}
+		else {
+			scratch_.resize(len);
+			copy(scratch_.data(), len);
+			value = scratch_;
+			return;
+		}
 		offset_ += len;
 	}
 
 	template<typename T>
 	void read(T& value) {
-		if(offset_ + sizeof(T) > buffer_.size()) {
+		static_assert(std::is_trivially_copyable_v<T>, "Type must be trivially copyable");
+		if(sizeof(T) > size()) {
 			throw std::runtime_error("read out of bounds");
 		}
-		std::memcpy(&value, buffer_.data() + offset_, sizeof(T));
-		offset_ += sizeof(T);
+		if(offset_ + sizeof(T) <= first_.size()) {
+			std::memcpy(&value, first_.data() + offset_, sizeof(T));
+			offset_ += sizeof(T);
+		}
+		else {
+			copy(&value, sizeof(T));
+		}
 	}
 
 	template<typename T>
@@ -67,14 +122,30 @@ public:
 	}
 
 	bool is_end() const {
-		return offset_ >= buffer_.size();
+		return offset_ >= first_.size() + second_.size();
 	}
 
 	size_t size() const {
-		return buffer_.size() - offset_;
+		return first_.size() + second_.size() - offset_;
 	}
 
 private:
-	const std::vector<uint8_t>& buffer_;
+	// Медленный путь: поле пересекает границу сегментов
+	void copy(void* dst, size_t len) {
+		auto* out = static_cast<uint8_t*>(dst);
+		if(offset_ < first_.size()) {
+			const size_t head = first_.size() - offset_;
+			std::memcpy(out, first_.data() + offset_, head);
+			out += head;
+			len -= head;
+			offset_ += head;
+		}
+		std::memcpy(out, second_.data() + (offset_ - first_.size()), len);
+		offset_ += len;
+	}
+
+	std::span<const uint8_t> first_;
+	std::span<const uint8_t> second_;
 	size_t offset_;
-};
+	std::string scratch_;               // поле на стыке сегментов (см. выше)
+};
\ No newline at end of file
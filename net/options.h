@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include <charconv>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// -----------------------------------------------------------------------------
+// Аргументы командной строки вида --name=value (или просто --flag).
+// -----------------------------------------------------------------------------
+class options
+{
+public:
+	options(int argc, char* argv[])
+	{
+		for(int i = 1; i < argc; ++i) {
+			std::string_view arg = argv[i];
+			if(!arg.starts_with("--"))
+				throw std::invalid_argument("unexpected argument: " + std::string(arg));
+
+			arg.remove_prefix(2);
+			const auto eq = arg.find('=');
+			if(eq == std::string_view::npos)
+				values_[std::string(arg)] = "true";
+			else
+				values_[std::string(arg.substr(0, eq))] = std::string(arg.substr(eq + 1));
+		}
+	}
+
+	template<class T>
+	T get(std::string_view name, T def) const
+	{
+		auto it = values_.find(name);
+		if(it == values_.end())
+			return def;
+
+		const std::string& value = it->second;
+		if constexpr(std::is_same_v<T, bool>) {
+			return value == "true" || value == "1" || value == "yes" || value == "on";
+		}
+		else if constexpr(std::is_arithmetic_v<T>) {
+			T result{};
+			auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+			if(ec != std::errc{} || end != value.data() + value.size())
+				throw std::invalid_argument("bad value for --" + std::string(name) + ": " + value);
+			return result;
+		}
+		else {
+			return T(value);
+		}
+	}
+
+private:
+	std::map<std::string, std::string, std::less<>> values_;
+};
@@ -0,0 +1,100 @@
+﻿#pragma once
+
+#include "buffer_pool.h"
+
+#include <deque>
+#include <span>
+
+// -----------------------------------------------------------------------------
+// Исходящая арена соединения: список чанков из buffer_pool.
+// Кадр сериализуется один раз прямо в хвост арены, а writer отправляет
+// готовые байты из чанков без промежуточных копий.
+// Записанное, но ещё не отправленное не двигается: новые кадры пишутся
+// только после end, чанки не переаллоцируются.
+// Последний опустевший чанк обычного размера остаётся у соединения: цикл
+// «ответ — запись» не ходит в пул (и под его мьютекс) на каждую запись.
+// Простаивающее соединение отдаёт и его (trim).
+// -----------------------------------------------------------------------------
+class output_arena
+{
+public:
+	static constexpr size_t CHUNK_SIZE = buffer_pool::MIN_BUFFER_SIZE; // 16 KB: столько держит соединение между записями
+
+	// Место ровно под len байт в хвосте арены
+	std::span<uint8_t> allocate(size_t len)
+	{
+		if(chunks_.empty() || chunks_.back().buffer.size() - chunks_.back().end < len)
+			chunks_.push_back({ buffer_pool::instance().acquire(std::max(len, CHUNK_SIZE)) });
+
+		auto& tail = chunks_.back();
+		std::span<uint8_t> out(tail.buffer.data() + tail.end, len);
+		tail.end += len;
+		size_ += len;
+		return out;
+	}
+
+	// Неотправленные байты по чанкам: не больше max_segments кусков и max_bytes байт
+	template<class t_visitor>
+	size_t gather(size_t max_segments, size_t max_bytes, t_visitor&& visitor) const
+	{
+		size_t bytes = 0, segments = 0;
+		for(const auto& c : chunks_) {
+			if(segments == max_segments || bytes == max_bytes) break;
+
+			const size_t len = std::min(c.end - c.begin, max_bytes - bytes);
+			if(len == 0) continue;
+
+			visitor(std::span<const uint8_t>(c.buffer.data() + c.begin, len));
+			bytes += len;
+			++segments;
+		}
+		return bytes;
+	}
+
+	// Отправленные байты: пустые чанки возвращаются в пул, кроме последнего
+	// обычного размера — он начинается заново
+	void consume(size_t len)
+	{
+		size_ -= len;
+		while(len > 0) {
+			auto& head = chunks_.front();
+			const size_t n = std::min(len, head.end - head.begin);
+			head.begin += n;
+			len -= n;
+
+			if(head.begin != head.end) continue;
+
+			if(chunks_.size() == 1 && head.buffer.size() == CHUNK_SIZE)
+				head.begin = head.end = 0;
+			else
+				chunks_.pop_front();
+		}
+	}
+
+	// Всё отправлено — удержанный чанк возвращается в пул
+	void trim()
+	{
+		if(empty())
+			chunks_.clear();
+	}
+
+	void clear()
+	{
+		chunks_.clear();
+		size_ = 0;
+	}
+
+	inline size_t size () const { return size_; }
+	inline bool   empty() const { return size_ == 0; }
+
+private:
+	struct chunk
+	{
+		buffer_pool::buffer buffer;
+		size_t              begin = 0; // отправлено до
+		size_t              end   = 0; // записано до
+	};
+
+	std::deque<chunk> chunks_;
+	size_t            size_ = 0;
+};
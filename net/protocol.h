@@ -1,152 +1,234 @@
 ﻿#pragma once
 
+#include <array>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <variant>
 #include <vector>
 #include <memory.h>
+#include "buffer_pool.h"
+#include "codec.h"
 
 enum class ecommand_type : std::uint8_t
 {
 	GET,
 	SET,
 	GET_RESPONSE,
+	MULTI_GET,
+	MULTI_SET,
+	MULTI_GET_RESPONSE,
+	CREDIT,
+	ERROR_RESPONSE,
 };
 
-class base_command
-{
-public:
-	virtual ~base_command() = default;
-
-	inline base_command(ecommand_type type)
-		: type(type) {}
+// Предел кадра на проводе: больше не принимается и не отправляется
+constexpr size_t MAX_MESSAGE_SIZE = buffer_pool::MAX_BUFFER_SIZE; // 1 MB
 
-	base_command(base_command&& other) = delete;
-	base_command& operator=(base_command&& other) = delete;
-	base_command(const base_command&) = delete;
-	base_command& operator=(const base_command&) = delete;
+// Потокобезопасно: 1..65535 по кругу
+uint16_t next_request_id();
 
-	virtual memory_writer serialize          () const;
-	virtual size_t        get_serialized_size() const;
+inline void check_request_id(uint16_t request_id)
+{
+	if(request_id == 0)
+		throw std::runtime_error("request_id cannot be zero");
+}
+
+// -----------------------------------------------------------------------------
+// Команды — простые структуры; порядок в fields() — порядок полей на проводе.
+// Поля std::string_view не владеют байтами: у принятой команды они указывают
+// в кадр и годны только внутри process(); у отправляемой — в память
+// отправителя, которая нужна лишь до возврата из send() (кадр собирается сразу).
+// -----------------------------------------------------------------------------
+
+struct get_command
+{
+	static constexpr ecommand_type type = ecommand_type::GET;
 
-	virtual void read(memory_reader& view);
+	std::string_view key;
+	uint16_t         request_id = 0;
 
-private:
-	ecommand_type type;
+	static constexpr auto fields() { return std::make_tuple(&get_command::key, &get_command::request_id); }
+	inline void validate() const { check_request_id(request_id); }
 };
 
-class command : public base_command
+struct set_command
 {
-public:
-	inline command(ecommand_type type, const std::string& key)
-		: base_command(type), key(key) {}
+	static constexpr ecommand_type type = ecommand_type::SET;
 
-	inline command(ecommand_type type, std::string&& key)
-		: base_command(type), key(std::move(key)) {}
+	std::string key;
+	std::string value;
 
-	inline command(ecommand_type type)
-		: base_command(type) {}
+	static constexpr auto fields() { return std::make_tuple(&set_command::key, &set_command::value); }
+};
 
-	virtual memory_writer serialize          () const;
-	virtual size_t        get_serialized_size() const;
+struct get_command_response
+{
+	static constexpr ecommand_type type = ecommand_type::GET_RESPONSE;
+
+	// сервер отправляет ответ внутри эпохи: ключ — из кадра запроса, значение — из версии
+	std::string_view key;
+	uint16_t         request_id = 0;
+	uint64_t         reads      = 0;
+	uint64_t         writes     = 0;
+	std::string_view value;
+
+	static constexpr auto fields()
+	{
+		return std::make_tuple(&get_command_response::key, &get_command_response::request_id,
+			&get_command_response::reads, &get_command_response::writes, &get_command_response::value);
+	}
+	inline void validate() const { check_request_id(request_id); }
+};
 
-	virtual void read(memory_reader& view);
+// -- пакетные команды: много ключей в одном кадре
 
-	inline const std::string& get_key() const { return key; }
+struct multi_get_command
+{
+	static constexpr ecommand_type type = ecommand_type::MULTI_GET;
 
-private:
-	std::string key;
+	uint16_t                      request_id = 0;
+	std::vector<std::string_view> keys;
+
+	static constexpr auto fields() { return std::make_tuple(&multi_get_command::request_id, &multi_get_command::keys); }
+	inline void validate() const { check_request_id(request_id); }
 };
 
-class get_command : public command
+struct multi_set_command
 {
-public:
-	inline get_command(const std::string& key)
-		: command(ecommand_type::GET, key) {}
-
-	inline get_command(std::string&& key)
-		: command(ecommand_type::GET, std::move(key)) {}
+	static constexpr ecommand_type type = ecommand_type::MULTI_SET;
 
-	inline get_command()
-		: command(ecommand_type::GET) {}
+	using item = std::pair<std::string, std::string>;
 
-	memory_writer serialize          () const override;
-	size_t        get_serialized_size() const override;
+	std::vector<item> items;
 
-	void read(memory_reader& view) override;
-
-private:
-	uint16_t request_id = get_command::next_request_id();
-	static uint16_t next_request_id();
+	static constexpr auto fields() { return std::make_tuple(&multi_set_command::items); }
+};
 
-	friend class get_command_response;
+struct multi_get_command_response
+{
+	static constexpr ecommand_type type = ecommand_type::MULTI_GET_RESPONSE;
+
+	struct item
+	{
+		std::string_view key;
+		uint64_t         reads  = 0;
+		uint64_t         writes = 0;
+		std::string_view value;
+
+		static constexpr auto fields() { return std::make_tuple(&item::key, &item::reads, &item::writes, &item::value); }
+	};
+
+	uint16_t          request_id = 0;
+	std::vector<item> items;
+
+	static constexpr auto fields()
+	{
+		return std::make_tuple(&multi_get_command_response::request_id, &multi_get_command_response::items);
+	}
+	inline void validate() const { check_request_id(request_id); }
 };
 
-class set_command : public command
+// -- управление потоком: сервер разрешает клиенту прислать ещё credits кадров
+
+struct credit_command
 {
-public:
-	inline set_command(const std::string& key, const std::string& value)
-		: command(ecommand_type::SET, key), value(value) {}
+	static constexpr ecommand_type type = ecommand_type::CREDIT;
 
-	inline set_command(std::string&& key, std::string&& value)
-		: command(ecommand_type::SET, std::move(key)), value(std::move(value)) {}
+	uint32_t credits = 0;
 
-	inline set_command()
-		: command(ecommand_type::SET) {}
+	static constexpr auto fields() { return std::make_tuple(&credit_command::credits); }
+};
 
-	memory_writer serialize          () const override;
-	size_t        get_serialized_size() const override;
+// -- отказ: на запрос request_id ответа не будет, причина — в message
 
-	void read(memory_reader& view) override;
+struct error_response
+{
+	static constexpr ecommand_type type = ecommand_type::ERROR_RESPONSE;
 
-	inline const std::string& get_value() const { return value; }
+	uint16_t         request_id = 0;
+	std::string_view message;
 
-private:
-	std::string value;
+	static constexpr auto fields() { return std::make_tuple(&error_response::request_id, &error_response::message); }
+	inline void validate() const { check_request_id(request_id); }
 };
 
-using base_command_ptr = std::shared_ptr<base_command>;
-using get_command_ptr = std::shared_ptr<get_command>;
-using set_command_ptr = std::shared_ptr<set_command>;
-
-class get_command_response : public command
+static_assert(codec::static_size<credit_command>() == sizeof(uint32_t));
+static_assert(codec::static_size<get_command_response>() == 2 * sizeof(uint32_t) + sizeof(uint16_t) + 2 * sizeof(uint64_t));
+
+// Любая команда протокола. Индекс альтернативы совпадает с ecommand_type
+using message = std::variant<
+	get_command,
+	set_command,
+	get_command_response,
+	multi_get_command,
+	multi_set_command,
+	multi_get_command_response,
+	credit_command,
+	error_response
+>;
+
+template<size_t... I>
+constexpr bool message_matches_types(std::index_sequence<I...>)
+{
+	return ((static_cast<size_t>(std::variant_alternative_t<I, message>::type) == I) && ...);
+}
+static_assert(message_matches_types(std::make_index_sequence<std::variant_size_v<message>>{}),
+	"message alternatives must follow ecommand_type order");
+
+// -----------------------------------------------------------------------------
+// Заранее сериализованный кадр GET_RESPONSE для одной версии значения.
+// Ключ и значение не меняются, поэтому кадр строится один раз; при отправке
+// он копируется целиком, а request_id, reads и writes подставляются на место.
+// -----------------------------------------------------------------------------
+class prepared_get_response
 {
 public:
-	inline get_command_response(const get_command_ptr& cmd, const std::string& value, uint64_t reads, uint64_t writes)
-		: command(ecommand_type::GET_RESPONSE, cmd->get_key()), request_id(cmd->request_id)
-		, value(value), reads(reads), writes(writes)
-	{}
+	prepared_get_response(std::string_view key, std::string_view value)
+	{
+		const get_command_response response{ key, 1, 0, 0, value };
+
+		frame_.resize(codec::frame_size(response));
+		memory_writer writer{ frame_ };
+		codec::encode_frame(writer, response);
+
+		request_id_offset_ = codec::FRAME_HEADER_SIZE + sizeof(uint32_t) + key.size();
+	}
 
-	inline get_command_response() : command(ecommand_type::GET_RESPONSE) {}
+	inline size_t size() const { return frame_.size(); }
 
-	memory_writer serialize          () const override;
-	size_t        get_serialized_size() const override;
+	void write(std::span<uint8_t> out, uint16_t request_id, uint64_t reads, uint64_t writes) const
+	{
+		std::memcpy(out.data(), frame_.data(), frame_.size());
 
-	void read(memory_reader& view) override;
+		uint8_t* patch = out.data() + request_id_offset_;
+		std::memcpy(patch, &request_id, sizeof(request_id));
+		std::memcpy(patch + sizeof(request_id), &reads, sizeof(reads));
+		std::memcpy(patch + sizeof(request_id) + sizeof(reads), &writes, sizeof(writes));
+	}
 
-	inline uint16_t           get_request_id() const { return request_id; }
-	inline const std::string& get_value     () const { return value; }
-	inline uint64_t           get_reads     () const { return reads; }
-	inline uint64_t           get_writes    () const { return writes; }
-	
 private:
-	uint16_t request_id = 0;
-	uint64_t reads      = 0;
-	uint64_t writes     = 0;
-		
-	std::string value;
+	std::vector<uint8_t> frame_;
+	size_t               request_id_offset_ = 0;
 };
 
-using get_command_response_ptr = std::shared_ptr<get_command_response>;
-
 class i_socket
 {
 public:
 	virtual ~i_socket() = default;
-	
-	virtual void send(const base_command_ptr& cmd) = 0;
+
+	// Вне цикла разбора кадр сериализуется до возврата: msg может ссылаться на память вызывающего
+	virtual void send     (const message& msg) = 0;
+	virtual void send_many(std::span<const message> msgs) = 0; // один переход на strand на всю пачку
+
+	// Готовый кадр GET_RESPONSE: копия в выходной буфер и подстановка изменчивых полей.
+	// Кадр нужен только до возврата (вызывать, пока его держит версия — внутри эпохи)
+	virtual void send(const prepared_get_response& frame, uint16_t request_id, uint64_t reads, uint64_t writes) = 0;
 };
 
 using i_socket_ptr = std::shared_ptr<i_socket>;
@@ -155,18 +237,75 @@ class i_server_dispatcher
 {
 public:
 	virtual ~i_server_dispatcher() = default;
-	
-	virtual void process(const get_command_ptr& cmd, const i_socket_ptr& socket) = 0;
-	virtual void process(const set_command_ptr& cmd, const i_socket_ptr& socket) = 0;
+
+	virtual void process(const get_command& cmd, const i_socket_ptr& socket) = 0;
+	virtual void process(const set_command& cmd, const i_socket_ptr& socket) = 0;
+	virtual void process(const multi_get_command& cmd, const i_socket_ptr& socket) = 0;
+	virtual void process(const multi_set_command& cmd, const i_socket_ptr& socket) = 0;
 };
 
 class i_client_dispatcher
 {
 public:
 	virtual ~i_client_dispatcher() = default;
-	
-	virtual void process(const get_command_response_ptr& cmd, const i_socket_ptr& socket) = 0;
+
+	virtual void process(const get_command_response& cmd, const i_socket_ptr& socket) = 0;
+	virtual void process(const multi_get_command_response& cmd, const i_socket_ptr& socket) = 0;
+	virtual void process(const credit_command& cmd, const i_socket_ptr& socket) = 0;
+	virtual void process(const error_response& cmd, const i_socket_ptr& socket) = 0;
 };
 
-void read(const std::vector<uint8_t>& buf, i_server_dispatcher& dispatcher, const i_socket_ptr& socket);
-void read(const std::vector<uint8_t>& buf, i_client_dispatcher& dispatcher, const i_socket_ptr& socket);
\ No newline at end of file
+// -----------------------------------------------------------------------------
+// Разбор кадра: тип → таблица переходов, собранная на этапе компиляции.
+// Команда декодируется на стеке и передаётся диспетчеру по ссылке;
+// команды, которых диспетчер не принимает, — ошибка протокола.
+// -----------------------------------------------------------------------------
+namespace detail
+{
+	template<class t_dispatcher, size_t I>
+	void decode_and_process(memory_reader& reader, t_dispatcher& dispatcher, const i_socket_ptr& socket)
+	{
+		using command_t = std::variant_alternative_t<I, message>;
+
+		if constexpr(requires(t_dispatcher& d, const command_t& cmd, const i_socket_ptr& s) { d.process(cmd, s); }) {
+			command_t cmd;
+			codec::decode(reader, cmd);
+
+			if(!reader.is_end())
+				throw std::runtime_error("truncated buffer: reader.size() = " + std::to_string(reader.size()) + ", !reader.is_end()");
+
+			dispatcher.process(cmd, socket);
+		}
+		else {
+			throw std::runtime_error("unexpected command type " + std::to_string(I));
+		}
+	}
+
+	template<class t_dispatcher, size_t... I>
+	constexpr auto make_jump_table(std::index_sequence<I...>)
+	{
+		using handler = void(*)(memory_reader&, t_dispatcher&, const i_socket_ptr&);
+		return std::array<handler, sizeof...(I)>{ &decode_and_process<t_dispatcher, I>... };
+	}
+}
+
+template<class t_dispatcher>
+void read(memory_reader reader, t_dispatcher& dispatcher, const i_socket_ptr& socket)
+{
+	static constexpr auto table =
+		detail::make_jump_table<t_dispatcher>(std::make_index_sequence<std::variant_size_v<message>>{});
+
+	uint8_t type_raw;
+	reader.read(type_raw);
+
+	if(type_raw >= table.size())
+		throw std::runtime_error("unknown command type");
+
+	table[type_raw](reader, dispatcher, socket);
+}
+
+template<class t_dispatcher>
+inline void read(std::span<const uint8_t> buf, t_dispatcher& dispatcher, const i_socket_ptr& socket)
+{
+	read(memory_reader{ buf }, dispatcher, socket);
+}
@@ -0,0 +1,82 @@
+﻿#pragma once
+
+#include "buffer_pool.h"
+
+#include <array>
+#include <cstring>
+#include <span>
+
+// -----------------------------------------------------------------------------
+// Кольцевой приёмный буфер поверх буфера из buffer_pool.
+// Данные не сдвигаются после каждого чтения: кадр, пересёкший конец буфера,
+// разбирается на месте как два сегмента. Ёмкость — степень двойки (классы пула),
+// поэтому позиции заворачиваются маской.
+// -----------------------------------------------------------------------------
+class ring_buffer
+{
+public:
+	using segments         = std::array<std::span<const uint8_t>, 2>;
+	using mutable_segments = std::array<std::span<uint8_t>, 2>;
+
+	explicit ring_buffer(size_t capacity = buffer_pool::MIN_BUFFER_SIZE)
+		: buffer_(buffer_pool::instance().acquire(capacity)) {}
+
+	inline size_t size    () const { return size_; }
+	inline size_t capacity() const { return buffer_.size(); }
+	inline bool   empty   () const { return size_ == 0; }
+
+	// Свободное место (до двух сегментов) — сюда читает сокет
+	mutable_segments writable()
+	{
+		const size_t tail = wrap(head_ + size_);
+		const size_t free = capacity() - size_;
+		const size_t first = std::min(free, capacity() - tail);
+		return { std::span<uint8_t>(buffer_.data() + tail, first),
+		         std::span<uint8_t>(buffer_.data(), free - first) };
+	}
+
+	inline void commit(size_t n) { size_ += n; }
+
+	// len байт, начиная с offset от начала непрочитанных данных
+	segments readable(size_t offset, size_t len) const
+	{
+		const size_t begin = wrap(head_ + offset);
+		const size_t first = std::min(len, capacity() - begin);
+		return { std::span<const uint8_t>(buffer_.data() + begin, first),
+		         std::span<const uint8_t>(buffer_.data(), len - first) };
+	}
+
+	void peek(void* dst, size_t len, size_t offset = 0) const
+	{
+		auto [first, second] = readable(offset, len);
+		std::memcpy(dst, first.data(), first.size());
+		std::memcpy(static_cast<uint8_t*>(dst) + first.size(), second.data(), second.size());
+	}
+
+	void consume(size_t n)
+	{
+		size_ -= n;
+		// пустое кольцо начинаем с нуля — так следующие кадры чаще лежат одним куском
+		head_ = size_ == 0 ? 0 : wrap(head_ + n);
+	}
+
+	// Перекладывает данные в буфер класса, вмещающего min_capacity байт.
+	// Используется для роста под большой кадр и для возврата памяти в пул.
+	void resize(size_t min_capacity)
+	{
+		const size_t new_capacity = buffer_pool::class_size(std::max(min_capacity, size_));
+		if(new_capacity == capacity()) return;
+
+		auto next = buffer_pool::instance().acquire(new_capacity);
+		peek(next.data(), size_);
+		buffer_ = std::move(next);
+		head_ = 0;
+	}
+
+private:
+	inline size_t wrap(size_t pos) const { return pos & (capacity() - 1); }
+
+	buffer_pool::buffer buffer_;
+	size_t              head_ = 0;
+	size_t              size_ = 0;
+};
@@ -0,0 +1,121 @@
+﻿#pragma once
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class i_idle_watch;
+
+// -----------------------------------------------------------------------------
+// Общее хешированное колесо таймеров для отслеживания простоя.
+// Активность объекта — только запись текущего тика (без таймеров и аллокаций);
+// один обработчик раз в тик обходит свой слот и будит просроченных.
+// Таймер взводится, пока есть за кем следить, — пустое колесо не держит io_context.
+// -----------------------------------------------------------------------------
+class timer_wheel
+{
+public:
+	using tick_t = uint64_t;
+
+	static constexpr size_t SLOTS = 64;
+
+	explicit timer_wheel(boost::asio::io_context& io, std::chrono::milliseconds tick = std::chrono::seconds(1))
+		: timer_(io), tick_(tick) {}
+
+	inline tick_t now() const { return now_.load(std::memory_order_relaxed); }
+
+	// Переводит длительность в тики (с округлением вверх)
+	inline tick_t to_ticks(std::chrono::milliseconds d) const
+	{
+		return (d.count() + tick_.count() - 1) / tick_.count();
+	}
+
+	void watch(std::weak_ptr<i_idle_watch> item, tick_t deadline);
+
+private:
+	void arm();
+	void on_tick();
+
+	using slot = std::vector<std::weak_ptr<i_idle_watch>>;
+
+	boost::asio::steady_timer       timer_;
+	const std::chrono::milliseconds tick_;
+	std::atomic<tick_t>             now_{ 0 };
+
+	std::mutex                      mutex_;
+	std::array<slot, SLOTS>         slots_;
+	size_t                          watched_ = 0;
+	bool                            armed_   = false;
+};
+
+// Объект, за простоем которого следит timer_wheel
+class i_idle_watch
+{
+public:
+	virtual ~i_idle_watch() = default;
+
+	// Тик, начиная с которого объект простаивает; 0 — больше не следить
+	virtual timer_wheel::tick_t idle_deadline() const = 0;
+	virtual void                on_idle      () = 0;
+};
+
+inline void timer_wheel::watch(std::weak_ptr<i_idle_watch> item, tick_t deadline)
+{
+	std::lock_guard lock(mutex_);
+	deadline = std::max(deadline, now() + 1); // текущий слот уже обойдён
+	slots_[deadline % SLOTS].push_back(std::move(item));
+	++watched_;
+	arm();
+}
+
+inline void timer_wheel::arm()
+{
+	if(armed_ || watched_ == 0) return;
+	armed_ = true;
+
+	timer_.expires_after(tick_);
+	timer_.async_wait([this](const boost::system::error_code& ec) {
+		if(!ec) on_tick();
+	});
+}
+
+inline void timer_wheel::on_tick()
+{
+	const tick_t now = now_.fetch_add(1, std::memory_order_relaxed) + 1;
+
+	slot due;
+	{
+		std::lock_guard lock(mutex_);
+		armed_ = false;
+		due.swap(slots_[now % SLOTS]);
+		watched_ -= due.size();
+	}
+
+	std::vector<std::pair<std::weak_ptr<i_idle_watch>, tick_t>> later;
+	for(auto& weak : due) {
+		auto item = weak.lock();
+		if(!item) continue;
+
+		const tick_t deadline = item->idle_deadline();
+		if(deadline == 0) continue;
+
+		if(deadline <= now)
+			item->on_idle();
+		else
+			later.emplace_back(std::move(weak), deadline); // была активность — в слот нового срока
+	}
+
+	std::lock_guard lock(mutex_);
+	for(auto& [weak, deadline] : later) {
+		slots_[deadline % SLOTS].push_back(std::move(weak));
+		++watched_;
+	}
+	arm();
+}
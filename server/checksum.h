@@ -0,0 +1,36 @@
+﻿#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (IEEE 802.3), таблица строится на этапе компиляции
+namespace checksum
+{
+	namespace detail
+	{
+		constexpr std::array<std::uint32_t, 256> make_crc32_table()
+		{
+			std::array<std::uint32_t, 256> table{};
+			for(std::uint32_t i = 0; i < 256; ++i) {
+				std::uint32_t c = i;
+				for(int k = 0; k < 8; ++k)
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				table[i] = c;
+			}
+			return table;
+		}
+
+		inline constexpr auto crc32_table = make_crc32_table();
+	}
+
+	// crc — значение по предыдущему куску, для продолжения
+	inline std::uint32_t crc32(const void* data, std::size_t size, std::uint32_t crc = 0)
+	{
+		const auto* p = static_cast<const std::uint8_t*>(data);
+		crc = ~crc;
+		for(std::size_t i = 0; i < size; ++i)
+			crc = detail::crc32_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+}
@@ -1,100 +1,604 @@
 ﻿#include "config_store.h"
+#include "checksum.h"
+#include "response_cache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <immer/algorithm.hpp>     // immer::diff — изменения между версиями за O(изменений)
 #include <immer/map_transient.hpp> // для загрузки в временную версию дерева
 
-std::optional<std::pair<const std::string&, entry_ptr>> config_store::get(const std::string& key) {
-	auto snap = root_.load();               // захватываем «снимок» RB-дерева
-	auto entry_ptr = snap->find(key);
-	if(entry_ptr == nullptr) return std::nullopt;
+namespace
+{
+	enum class delta_op : uint8_t { set, erase };
+
+	// запись индекса снимка версии 1: [uint32 key size][uint32 value size][uint64 value offset][uint32 value crc][key]
+	constexpr size_t V1_RECORD_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+
+	template<class T>
+	void append_pod(std::vector<char>& out, const T& v)
+	{
+		const auto* p = reinterpret_cast<const char*>(&v);
+		out.insert(out.end(), p, p + sizeof(v));
+	}
+
+	template<class T>
+	T load_pod(const char* p)
+	{
+		T v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	// left — сколько байт файла ещё не прочитано
+	template<class T>
+	bool read_pod(std::istream& in, T& v, uint64_t& left)
+	{
+		if(left < sizeof(v) || !in.read(reinterpret_cast<char*>(&v), sizeof(v))) return false;
+		left -= sizeof(v);
+		return true;
+	}
+
+	// размер строки ничем не проверен: мусорный не должен заказать гигабайты
+	bool read_string(std::istream& in, std::string& s, uint64_t& left)
+	{
+		size_t size;
+		if(!read_pod(in, size, left) || size > left) return false;
+		s.resize(size);
+		left -= size;
+		return static_cast<bool>(in.read(s.data(), size));
+	}
+
+	uint64_t file_size(const std::string& path)
+	{
+		std::error_code ec;
+		const auto size = std::filesystem::file_size(path, ec);
+		return ec ? 0 : size;
+	}
+
+	template<class T>
+	void write_pod(std::ostream& out, const T& v)
+	{
+		out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+	}
+
+	void write_string(std::ostream& out, std::string_view s)
+	{
+		write_pod(out, s.size());
+		out.write(s.data(), s.size());
+	}
 
-	(*entry_ptr)->reads++;      // atomic++
-	stats.add_get();
-	return { {key, *entry_ptr} };
+	// пишем рядом и подменяем: оборванная запись не портит прежний файл
+	template<class F>
+	size_t write_replacing(const std::string& path, F&& write)
+	{
+		const std::string tmp = path + ".tmp";
+		size_t bytes = 0;
+		{
+			std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				throw std::ios_base::failure("Failed to open file for writing");
+			}
+
+			write(out);
+
+			out.flush(); // Сбрасываем буфер в файл
+			if(!out) {
+				throw std::ios_base::failure("Failed to write data to file");
+			}
+			bytes = static_cast<size_t>(out.tellp());
+		}
+
+		sync_path(tmp);                 // до удаления журнала файл должен быть на диске
+		std::filesystem::rename(tmp, path);
+		return bytes;
+	}
+}
+
+size_t config_store::shard_index(std::string_view key) const {
+	// immer::map раскладывает ключи по младшим битам того же хеша (key_hash) —
+	// шард выбираем по старшим, иначе внутри шарда дерево вырождается
+	const uint64_t hash = key_hash{}(key);
+	return static_cast<size_t>(hash >> 32) % shards_.size();
+}
+
+entry::~entry() {
+	if(const auto* r = response.load(std::memory_order_acquire))
+		response_cache::instance().release(r);
+
+	const std::string* v = value_.load(std::memory_order_acquire);
+	if(v != &owned_) delete v;          // копия значения из снимка
+}
+
+std::string_view entry::checked_mapped() const {
+	if(checksum::crc32(mapped_.bytes.data(), mapped_.bytes.size()) != mapped_.crc)
+		throw std::runtime_error("Snapshot value is corrupted");
+	return mapped_.bytes;
+}
+
+std::shared_ptr<key_stats> entry::shared_stats() const {
+	auto owner = stats_owner_.load(std::memory_order_acquire);
+	if(!owner) {
+		auto fresh = make_key_stats();
+		if(stats_owner_.compare_exchange_strong(owner, fresh, std::memory_order_acq_rel))
+			owner = std::move(fresh);   // иначе owner — то, что успел поставить другой поток
+	}
+	stats_.store(owner.get(), std::memory_order_release);
+	return owner;
+}
+
+const std::string& entry::value() const {
+	if(const auto* v = value_.load(std::memory_order_acquire))
+		return *v;
+
+	const auto* copy = new std::string(checked_mapped());
+	const std::string* expected = nullptr;
+	if(!value_.compare_exchange_strong(expected, copy, std::memory_order_acq_rel)) {
+		delete copy;                    // другой поток успел первым
+		return *expected;
+	}
+	return *copy;
+}
+
+std::string_view entry::bytes() const {
+	if(const auto* v = value_.load(std::memory_order_acquire))
+		return *v;
+	return checked_mapped();
+}
+
+config_store::~config_store() {
+	if(base_merger_.joinable()) {
+		stop_merge_.store(true, std::memory_order_relaxed);
+		base_merger_.join();
+	}
+	for(auto& shard : shards_)          // читателей уже нет
+		delete shard.current.load(std::memory_order_relaxed);
+}
+
+void config_store::publish(shard& s, map next) {
+	const map* old = s.current.exchange(new map(std::move(next)), std::memory_order_seq_cst);
+	epoch_domain::instance().retire(old);
+}
+
+template<class t_map>
+entry_ptr config_store::updated_entry(const t_map& m, const std::string& key, std::string value) {
+	// старая версия остаётся нетронутой у тех, кто её уже читает
+	auto entry_ptr_ptr = m.find(key);
+	if(entry_ptr_ptr == nullptr)
+		return std::make_shared<const entry>(std::move(value), 1, make_key_stats());
+
+	const entry& prev = **entry_ptr_ptr;
+	return std::make_shared<const entry>(std::move(value), prev.version + 1, prev.shared_stats());
+}
+
+entry_ptr config_store::load_base(std::string_view key) {
+	auto item = base_->find(key);
+	if(!item || base_erased_.contains(key)) return nullptr;
+
+	auto& s = shard_for(key);
+	std::lock_guard lock(s.write_mutex);
+	const map& m = *s.current.load(std::memory_order_relaxed);
+	if(const entry_ptr* e = m.find(key)) return *e;   // успели SET, другой читатель или перенос
+
+	auto e = std::make_shared<const entry>(std::move(item->value));
+	publish(s, m.set(std::string(key), e));
+	return e;
+}
+
+void config_store::merge_base() {
+	const auto start = std::chrono::steady_clock::now();
+	constexpr size_t CHUNK = 4096;      // столько записей за один захват замков шардов
+	std::vector<std::vector<snapshot_index::item>> by_shard(shards_.size());
+	size_t merged = 0, corrupted = 0;
+
+	for(size_t begin = 0; begin < base_->size() && !stop_merge_.load(std::memory_order_relaxed); begin += CHUNK) {
+		const size_t end = std::min(begin + CHUNK, base_->size());
+		for(size_t i = begin; i < end; ++i) {
+			try {
+				auto item = base_->at(i);
+				if(!base_erased_.contains(item.key))
+					by_shard[shard_index(item.key)].push_back(std::move(item));
+			}
+			catch(const std::exception& e) {
+				std::cerr << e.what() << ", key skipped\n";
+				++corrupted;
+			}
+		}
+
+		for(size_t i = 0; i < shards_.size(); ++i) {
+			if(by_shard[i].empty()) continue;
+
+			auto& s = shards_[i];
+			std::lock_guard lock(s.write_mutex);
+			auto t = s.current.load(std::memory_order_relaxed)->transient();
+			auto f = flushed_[i].transient();
+			for(auto& item : by_shard[i]) {
+				if(f.find(item.key)) continue;  // дельта новее снимка
+				// в дереве — либо прочитанный из снимка (версия 0), либо новее: SET или журнал.
+				// flushed_ получает значение снимка: оно и есть на диске
+				const entry_ptr* current = t.find(item.key);
+				const std::string key(item.key);
+				auto base = current && (*current)->version == 0 ? *current : std::make_shared<const entry>(std::move(item.value));
+				if(!current) t.set(key, base);
+				f.set(key, std::move(base));
+				++merged;
+			}
+			publish(s, t.persistent());
+			flushed_[i] = f.persistent();
+			by_shard[i].clear();
+		}
+	}
+
+	{
+		std::lock_guard lock(base_mutex_);
+		base_merged_.store(true, std::memory_order_release);
+	}
+	base_done_.notify_all();
+	if(stop_merge_.load(std::memory_order_relaxed)) return;   // хранилище закрывается
+
+	std::cout << "Snapshot: " << merged << " keys merged in background in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms";
+	if(corrupted > 0) std::cout << ", " << corrupted << " corrupted records skipped";
+	std::cout << '\n';
+}
+
+void config_store::wait_base_loaded() {
+	std::unique_lock lock(base_mutex_);
+	base_done_.wait(lock, [&] { return base_merged_.load(std::memory_order_acquire); });
 }
 
 void config_store::set(const std::string& key, std::string value) {
-	root_.update([&](map m) {
-		auto entry_ptr_ptr = m.find(key);
-		entry_ptr entry_ = entry_ptr_ptr != nullptr ? *entry_ptr_ptr : std::make_shared<entry>();
-		entry_->value = std::move(value);
-		entry_->writes++;
-		return m.set(key, std::move(entry_));   // ← создаётся новое дерево, разделяя 99 % узлов
-	});
+	auto& s = shard_for(key);
+	{
+		std::lock_guard lock(s.write_mutex);
+		if(wal_) wal_->append(key, value);   // под замком шарда: порядок в журнале = порядок версий
+		const map& m = *s.current.load(std::memory_order_relaxed);
+		publish(s, m.set(key, updated_entry(m, key, std::move(value))));   // ← новое дерево шарда, разделяя 99 % узлов
+	}
 	stats.add_set();
-	dirty_.store(true, std::memory_order_relaxed);
 }
 
-bool config_store::flush_if_dirty()
+void config_store::set_many(const std::vector<std::pair<std::string, std::string>>& items) {
+	std::vector<std::vector<const std::pair<std::string, std::string>*>> by_shard(shards_.size());
+	std::vector<size_t> touched;
+	for(const auto& item : items) {
+		auto& bucket = by_shard[shard_index(item.first)];
+		if(bucket.empty()) touched.push_back(static_cast<size_t>(&bucket - by_shard.data()));
+		bucket.push_back(&item);
+	}
+
+	// несколько шардов — пакетом: замки шардов по возрастанию номера, версии
+	// готовятся заранее и публикуются внутри нечётного batch_seq_ (см. get_many)
+	std::sort(touched.begin(), touched.end());
+	std::unique_lock batch(batch_mutex_, std::defer_lock);
+	if(touched.size() > 1) batch.lock();
+
+	std::vector<std::unique_lock<std::mutex>> locks;
+	std::vector<map> next;
+	locks.reserve(touched.size());
+	next.reserve(touched.size());
+	for(const size_t i : touched) {
+		auto& s = shards_[i];
+		locks.emplace_back(s.write_mutex);
+		auto t = s.current.load(std::memory_order_relaxed)->transient();   // все ключи шарда — в одну версию
+		for(const auto* item : by_shard[i]) {
+			if(wal_) wal_->append(item->first, item->second);
+			t.set(item->first, updated_entry(t, item->first, item->second));
+		}
+		next.push_back(t.persistent());
+	}
+
+	if(touched.size() > 1) batch_seq_.fetch_add(1, std::memory_order_seq_cst);
+	for(size_t k = 0; k < touched.size(); ++k)
+		publish(shards_[touched[k]], std::move(next[k]));
+	if(touched.size() > 1) batch_seq_.fetch_add(1, std::memory_order_seq_cst);
+
+	stats.add_set(items.size());
+}
+
+bool config_store::needs_compaction() const
+{
+	// после ошибки журнала SET не принимаются, пока снимок не покроет потерянное
+	return wal_ && (wal_->size_bytes() >= wal_config_.compact_bytes || wal_->failed());
+}
+
+snapshot_result config_store::compact()
 {
-	if(!dirty_.exchange(false)) return false;
+	if(!wal_) return {};
+
+	// flushed_ дополняет перенос снимка — до его конца база для diff неполна
+	wait_base_loaded();
+
+	// всё, что в закрытых сегментах, уже опубликовано: запись в журнал и
+	// публикация идут под одним замком шарда, а мы берём его после rotate()
+	const uint64_t sealed = wal_->rotate();
+
+	std::vector<map> snaps;             // копия версии — пара счётчиков ссылок
+	snaps.reserve(shards_.size());
+	for(auto& shard : shards_) {
+		std::lock_guard lock(shard.write_mutex);
+		snaps.push_back(*shard.current.load(std::memory_order_relaxed));
+	}
 
-	std::ofstream out(file_, std::ios::binary);
-	if (!out) {
-		throw std::ios_base::failure("Failed to open file for writing");
+	// версии делят узлы с flushed_, поэтому diff обходит только изменённые ветви
+	std::vector<change> changes;
+	size_t total = 0;
+	for(size_t i = 0; i < snaps.size(); ++i) {
+		total += snaps[i].size();
+		immer::diff(flushed_[i], snaps[i],
+			[&](const auto& added) { changes.emplace_back(&added.first, added.second.get()); },
+			[&](const auto& removed) { changes.emplace_back(&removed.first, nullptr); },
+			[&](const auto&, const auto& changed) { changes.emplace_back(&changed.first, changed.second.get()); });
 	}
 
-	auto snap = root_.load();
-	auto data = *snap;
-	size_t size = data.size();
-	out.write(reinterpret_cast<const char*>(&size), sizeof(size)); // Записываем количество пар
+	snapshot_result result;
+	// дельта больше половины хранилища дешевле записать полным снимком
+	result.full = wal_config_.full_every == 0 || deltas_since_full_ >= wal_config_.full_every
+		|| changes.size() * 2 > total;
+
+	if(result.full) {
+		result.changes = total;
+		result.bytes = write_snapshot(snaps, delta_seq_);
+		drop_deltas(delta_seq_);        // всё из них уже в снимке
+		deltas_since_full_ = 0;
+	}
+	else {
+		result.changes = changes.size();
+		result.bytes = write_delta(changes, delta_seq_ + 1);
+		++delta_seq_;
+		++deltas_since_full_;
+	}
 
-	for (const auto& [key, entry] : data) {
-		size_t key_size = key.size();
-		size_t value_size = entry->value.size();
+	flushed_ = std::move(snaps);
+	wal_->drop_segments(sealed);        // состояние на диске — закрытые сегменты больше не нужны
+	return result;
+}
+
+size_t config_store::write_snapshot(const std::vector<map>& snaps, uint64_t delta_seq)
+{
+	// индекс версии 2 упорядочен по ключу — для двоичного поиска при старте
+	std::vector<std::pair<const std::string*, const entry*>> items;
+	for(const auto& snap : snaps)
+		for(const auto& [key, entry] : snap)
+			items.emplace_back(&key, entry.get());
+	std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return *a.first < *b.first; });
+
+	return write_replacing(file_, [&](std::ostream& out) {
+		snapshot_header header{};
+		std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.version = SNAPSHOT_VERSION;
+		header.delta_seq = delta_seq;
+		header.count = items.size();
+		header.data_offset = sizeof(header);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // заполним в конце
+
+		// значения пишутся сразу, записи и ключи копятся и уходят за ними
+		std::vector<snapshot_record> records;
+		records.reserve(items.size());
+		std::string keys;
+		for(const auto& [key, entry] : items) {
+			const std::string_view value = entry->bytes();
+
+			snapshot_record& r = records.emplace_back();
+			r.key_offset = keys.size();
+			r.value_offset = header.data_size;
+			r.key_size = static_cast<uint32_t>(key->size());
+			r.value_size = static_cast<uint32_t>(value.size());
+			r.value_crc = checksum::crc32(value.data(), value.size());
+			r.record_crc = snapshot_record_checksum(r, *key);
+			keys += *key;
+
+			out.write(value.data(), value.size());
+			header.data_size += value.size();
+		}
+
+		header.index_offset = header.data_offset + header.data_size;
+		header.index_size = records.size() * sizeof(snapshot_record) + keys.size();
+		header.header_crc = snapshot_header_checksum(header);
+		out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(snapshot_record));
+		out.write(keys.data(), keys.size());
+
+		out.seekp(0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.seekp(0, std::ios::end);
+	});
+}
+
+size_t config_store::write_delta(const std::vector<change>& changes, uint64_t seq)
+{
+	// [size_t count] { [uint8 op][key][value — только для set] }
+	return write_replacing(delta_base() + "." + std::to_string(seq), [&](std::ostream& out) {
+		write_pod(out, changes.size());
+		for(const auto& [key, entry] : changes) {
+			write_pod(out, entry ? delta_op::set : delta_op::erase);
+			write_string(out, *key);
+			if(entry) write_string(out, entry->bytes());
+		}
+	});
+}
 
-		out.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));     // Размер ключа
-		out.write(key.data(), key_size);                                             // Ключ
-		out.write(reinterpret_cast<const char*>(&value_size), sizeof(value_size)); // Размер значения
-		out.write(entry->value.data(), value_size);                                         // Значение
+void config_store::drop_deltas(uint64_t last)
+{
+	for(const auto& [n, path] : list_numbered(delta_base())) {
+		if(n > last) break;
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
 	}
+}
+
+bool config_store::load_mapped(std::vector<map::transient_type>& t, uint64_t& delta_seq)
+{
+	auto file = mapped_file::open(file_);
+	if(!file) return true;              // снимка ещё нет
 
-	out.flush(); // Сбрасываем буфер в файл
-	if(!out) {
-		throw std::ios_base::failure("Failed to write data to file");
+	snapshot_header header;
+	if(file->size() < sizeof(header) || std::memcmp(file->data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+		return false;                   // прежний потоковый формат
+
+	std::memcpy(&header, file->data(), sizeof(header));
+	if(header.header_crc != snapshot_header_checksum(header))
+		throw std::runtime_error("Snapshot " + file_ + ": bad header checksum");
+	delta_seq = header.delta_seq;
+
+	if(header.version == SNAPSHOT_VERSION) {
+		// ключи в деревья перенесёт фоновый поток (merge_base), до тех пор — поиск по индексу
+		base_ = std::make_unique<snapshot_index>(std::move(file), header, file_);
+		return true;
 	}
+	if(header.version != 1)
+		throw std::runtime_error("Snapshot " + file_ + ": unsupported version " + std::to_string(header.version));
+
+	// версия 1: индекс в порядке обхода — проверяем целиком и строим деревья сразу;
+	// следующий полный снимок перепишет файл в версии 2
+	if(header.data_offset > file->size() || header.data_size > file->size() - header.data_offset
+		|| header.index_offset > file->size() || header.index_size > file->size() - header.index_offset)
+		throw std::runtime_error("Snapshot " + file_ + " is truncated");
+
+	const char* index = file->data() + header.index_offset;
+	if(checksum::crc32(index, header.index_size) != header.index_crc)
+		throw std::runtime_error("Snapshot " + file_ + ": bad index checksum");
 
-	return true; // Успешно сбросили данные в файл
+	const char* data = file->data() + header.data_offset;
+	size_t offset = 0;
+	for(uint64_t i = 0; i < header.count; ++i) {
+		if(header.index_size - offset < V1_RECORD_SIZE)
+			throw std::runtime_error("Snapshot " + file_ + ": index is truncated");
+
+		const char* record = index + offset;
+		const auto key_size     = load_pod<uint32_t>(record);
+		const auto value_size   = load_pod<uint32_t>(record + sizeof(uint32_t));
+		const auto value_offset = load_pod<uint64_t>(record + 2 * sizeof(uint32_t));
+		const auto value_crc    = load_pod<uint32_t>(record + 2 * sizeof(uint32_t) + sizeof(uint64_t));
+		offset += V1_RECORD_SIZE;
+
+		if(header.index_size - offset < key_size
+			|| value_offset > header.data_size || value_size > header.data_size - value_offset)
+			throw std::runtime_error("Snapshot " + file_ + ": index points outside the file");
+
+		std::string key(index + offset, key_size);
+		offset += key_size;
+
+		mapped_value value{ file, std::string_view(data + value_offset, value_size), value_crc };
+		t[shard_index(key)].set(std::move(key), std::make_shared<const entry>(std::move(value)));
+	}
+	return true;
 }
 
-void config_store::load_into(map& m)
+void config_store::load_stream(std::vector<map::transient_type>& t, uint64_t& delta_seq)
 {
+	// снимок до версии 1: поля по одному через ifstream; следующее сворачивание перепишет его в новом формате
 	std::ifstream in(file_, std::ios::binary | std::ios::in);
-	if (!in) {
-		return;
-	}
+	if (!in) return;
+	uint64_t left = file_size(file_);
 
-	auto t = m.transient(); // Получаем временную версию дерева для загрузки
-	//std::unordered_map<std::string, std::string> data;
-	size_t size;
-	in.read(reinterpret_cast<char*>(&size), sizeof(size)); // Читаем количество пар
+	size_t size = 0;
+	read_pod(in, size, left); // Читаем количество пар
 
 	for (size_t i = 0; i < size; ++i) {
-		size_t key_size, value_size;
-		in.read(reinterpret_cast<char*>(&key_size), sizeof(key_size)); // Размер ключа
+		std::string key, value;
+		if(!read_string(in, key, left) || !read_string(in, value, left))
+			throw std::runtime_error("Snapshot " + file_ + " is truncated or corrupted");
 
-		std::string key(key_size, '\0');
-		in.read(key.data(), key_size); // Ключ
+		entry_ptr entry_ = std::make_shared<const entry>(std::move(value), 0, nullptr);
 
-		in.read(reinterpret_cast<char*>(&value_size), sizeof(value_size)); // Размер значения
+		const size_t index = shard_index(key);
+		t[index].set(std::move(key), std::move(entry_));
+	}
 
-		std::string value(value_size, '\0');
-		in.read(value.data(), value_size); // Значение
+	if(!read_pod(in, delta_seq, left)) delta_seq = 0;
+}
 
-		entry_ptr entry_ = std::make_shared<entry>();
-		entry_->value = std::move(value);
+void config_store::load()
+{
+	for(auto& shard : shards_)
+		shard.current.store(new map(), std::memory_order_relaxed);
+
+	if(file_.empty()) return;
+
+	std::vector<map::transient_type> t(shards_.size()); // Временные версии деревьев шардов для загрузки
+
+	const auto start = std::chrono::steady_clock::now();
+	uint64_t snapshot_seq = 0;          // последняя дельта, вошедшая в снимок
+	if(!load_mapped(t, snapshot_seq))
+		load_stream(t, snapshot_seq);
 
-		t.set(std::move(key), std::move(entry_));
+	size_t loaded = base_ ? base_->size() : 0;
+	for(const auto& m : t)
+		loaded += m.size();
+	if(loaded > 0)
+		std::cout << "Snapshot: " << loaded << " keys opened in "
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+
+	// дельты после снимка — по порядку; более старые остались от прерванной записи снимка
+	delta_seq_ = snapshot_seq;
+	for(const auto& [n, path] : list_numbered(delta_base())) {
+		if(n <= snapshot_seq) {
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+			continue;
+		}
+
+		std::ifstream delta(path, std::ios::binary);
+		uint64_t left = file_size(path);
+		size_t count = 0;
+		read_pod(delta, count, left);
+		for(size_t i = 0; i < count; ++i) {
+			delta_op op;
+			std::string key, value;
+			if(!read_pod(delta, op, left) || !read_string(delta, key, left)
+				|| (op == delta_op::set && !read_string(delta, value, left)))
+				throw std::runtime_error("Snapshot delta " + path + " is truncated or corrupted");
+
+			auto& m = t[shard_index(key)];
+			if(op == delta_op::erase) {
+				m.erase(key);
+				if(base_) base_erased_.insert(std::move(key));
+			}
+			else
+				m.set(std::move(key), std::make_shared<const entry>(std::move(value), 0, nullptr));
+		}
+		delta_seq_ = n;
+		++deltas_since_full_;
 	}
 
-	m = t.persistent();
+	// то, что уже на диске, — база для следующей дельты; журнал поверх неё
+	flushed_.reserve(shards_.size());
+	for(size_t i = 0; i < shards_.size(); ++i) {
+		flushed_.push_back(t[i].persistent());
+		t[i] = flushed_[i].transient();
+	}
+
+	// затем журнал: всё, что записано после снимка (повтор уже учтённого безвреден — SET идемпотентен)
+	size_t replayed = 0;
+	write_ahead_log::replay(wal_base(), [&](std::string key, std::string value) {
+		auto& m = t[shard_index(key)];
+		m.set(key, updated_entry(m, key, std::move(value)));
+		++replayed;
+	});
+	if(replayed > 0)
+		std::cout << "WAL: replayed " << replayed << " records\n";
+
+	for(size_t i = 0; i < shards_.size(); ++i)      // читателей ещё нет — заменяем напрямую
+		delete shards_[i].current.exchange(new map(t[i].persistent()), std::memory_order_relaxed);
+
+	wal_ = std::make_unique<write_ahead_log>(wal_base(), wal_config_);
+
+	if(base_) {
+		base_merged_.store(false, std::memory_order_relaxed);
+		base_merger_ = std::thread([this] { merge_base(); });
+	}
 }
 
 void counters::dump_and_reset()
 {
-	std::cout << "[Stats] total: GET=" << get_total
-		<< " SET=" << set_total
-		<< " | last 5s: GET=" << get_window
-		<< " SET=" << set_window << '\n';
-	get_window = set_window = 0;
+	const uint64_t gets = get_total.load();
+	const uint64_t sets = set_total.load();
+
+	std::cout << "[Stats] total: GET=" << gets
+		<< " SET=" << sets
+		<< " | last 5s: GET=" << gets - get_dumped_
+		<< " SET=" << sets - set_dumped_ << '\n';
+	get_dumped_ = gets;
+	set_dumped_ = sets;
 }
\ No newline at end of file
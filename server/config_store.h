@@ -1,56 +1,260 @@
 ﻿#pragma once
 
 #include <immer/map.hpp>      // persistent RB-tree
-#include <immer/atom.hpp>     // lock-free атом с CAS
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <cstddef>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
+#include "epoch.h"
+#include "mapped_file.h"
+#include "snapshot_index.h"
+#include "stats.h"
+#include "wal.h"
+#include <protocol.h>
+
+// Версия значения ключа. После публикации в дереве не меняется:
+// каждый SET создаёт новую, читатель держит свою сколько нужно.
+// Значение, загруженное из снимка, остаётся в отображённом файле и
+// копируется в память при первом value(); счётчики такого ключа
+// создаются при первом stats() — старт не выделяет их на каждый ключ.
 struct entry {
-	std::string value;
-	std::atomic<uint64_t> reads{ 0 }, writes{ 0 };
+	// stats == nullptr — счётчики появятся при первом stats()
+	entry(std::string value, uint64_t version, std::shared_ptr<key_stats> stats)
+		: version(version), reads_base(stats ? stats->reads() : 0), stats_(stats.get()), stats_owner_(std::move(stats))
+		, owned_(std::move(value)), value_(&owned_) {}
+
+	explicit entry(mapped_value value)
+		: mapped_(std::move(value)) {}
+
+	~entry();
+
+	entry(const entry&) = delete;
+	entry& operator=(const entry&) = delete;
+
+	const std::string& value() const;
+
+	// Байты значения без копии в память (для записи снимка)
+	std::string_view bytes() const;
+
+	// Счётчики ключа, общие для всех его версий (см. stats.h)
+	inline key_stats& stats() const {
+		if(auto* s = stats_.load(std::memory_order_acquire)) return *s;
+		return *shared_stats();
+	}
+
+	// Те же счётчики для следующей версии ключа
+	std::shared_ptr<key_stats> shared_stats() const;
+
+	uint64_t    version = 0;            // число SET ключа (0 — загружено с диска); оно же writes
+	uint64_t    reads_base = 0;         // stats().reads() на момент публикации версии
+
+	// Готовый ответ на GET этой версии (см. response_cache); SET просто создаёт версию без него
+	mutable std::atomic<const prepared_get_response*> response{ nullptr };
+
+private:
+	std::string_view checked_mapped() const;
+
+	mutable std::atomic<key_stats*> stats_{ nullptr };              // быстрый путь stats()
+	mutable std::atomic<std::shared_ptr<key_stats>> stats_owner_;   // владеет, ставится один раз
+
+	std::string  owned_;                // значение версии из SET
+	mapped_value mapped_;               // значение в снимке, пока не скопировано
+	mutable std::atomic<const std::string*> value_{ nullptr }; // &owned_ или копия mapped_
 };
 
-using entry_ptr = std::shared_ptr<entry>;
-using map = immer::map<std::string, entry_ptr>;
-using atom = immer::atom<map>;      // thread-safe оболочка с compare-exchange
+using entry_ptr = std::shared_ptr<const entry>;
+
+// Хеш ключа для поиска по std::string_view без копии в std::string:
+// std::hash у string и string_view совпадает, поэтому дерево одно и то же
+struct key_hash {
+	using is_transparent = void;
+	inline size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+};
 
-// ---------- статистика ----------
-struct counters {
-	std::atomic<uint64_t> get_total{ 0 }, set_total{ 0 };
-	std::atomic<uint64_t> get_window{ 0 }, set_window{ 0 };
+using map = immer::map<std::string, entry_ptr, key_hash, std::equal_to<>>;
 
-	void add_get() { ++get_total; ++get_window; }
-	void add_set() { ++set_total; ++set_window; }
+// ---------- хранилище ----------
+// Ключи разбиты по шардам (хеш ключа → шард). Версия дерева шарда —
+// указатель, который писатель заменяет под мьютексом шарда, а старую
+// версию отдаёт epoch_domain. Читатель не трогает ни мьютекс, ни счётчики
+// ссылок: вход в эпоху пишет только в свой слот. MULTI_SET по нескольким
+// шардам публикует их версии внутри batch_seq_ (seqlock): MULTI_GET берёт
+// снимки нужных шардов между двумя чтениями счётчика и видит пакет целиком
+// или не видит вовсе.
+// Каждый SET сначала попадает в журнал (wal.h); при сворачивании журнала
+// пишется дельта к последнему записанному состоянию (immer::diff — цена
+// пропорциональна числу изменений, а не размеру хранилища), каждая
+// wal_config::full_every-я — полный снимок. Старт: снимок + дельты + журнал.
+// Ключи снимка переносятся в деревья фоновым потоком уже после старта; до
+// конца переноса промах по дереву ищется в индексе снимка (load_base).
+constexpr size_t DEFAULT_SHARD_COUNT = 16;
 
-	void dump_and_reset();
+// Итог одного сворачивания журнала
+struct snapshot_result {
+	bool   full    = false;         // полный снимок или дельта
+	size_t changes = 0;             // записей в файле (для полного — все ключи)
+	size_t bytes   = 0;
 };
 
 class config_store {
 public:
-	explicit config_store(std::string file) : file_(std::move(file)) {
-		root_.update([&](map m) {        // загрузка в атом
-			load_into(m);
-			return m;                   // первый снимок
-		});
+	// Пустой file — только память, без снимка и журнала
+	explicit config_store(std::string file, size_t shard_count = DEFAULT_SHARD_COUNT, const wal_config& wal = {})
+		: file_(std::move(file)), shards_(std::max<size_t>(shard_count, 1)), wal_config_(wal) {
+		load();
 	}
 
-	/* ---------- GET: 0-локов, 0-копий ---------- */
-	std::optional<std::pair<const std::string&, entry_ptr>> get(const std::string& key);
+	~config_store();
 
-	/* ---------- SET: path-copy без цикла ---------- */
+	/* ---------- GET: 0-локов, 0-копий; visit(const entry_ptr&) — внутри эпохи ---------- */
+	template<class F>
+	bool get(std::string_view key, F&& visit);
+
+	/* ---------- MULTI_GET: согласованные снимки шардов; visit(i, const entry_ptr*), nullptr — нет ключа ---------- */
+	template<class F>
+	void get_many(const std::vector<std::string_view>& keys, F&& visit);
+
+	/* ---------- SET: path-copy, публикация одной заменой указателя ---------- */
 	void set(const std::string& key, std::string value);
 
-	bool flush_if_dirty();
+	/* ---------- MULTI_SET: одна новая версия на каждый затронутый шард, все — разом для MULTI_GET ---------- */
+	void set_many(const std::vector<std::pair<std::string, std::string>>& items);
+
+	/* ---------- журнал вырос — пора свернуть в новый снимок ---------- */
+	bool needs_compaction() const;
+
+	// Снимок или дельта + удаление свёрнутого журнала. Пишет диск — не звать
+	// из io-потоков (см. snapshot_writer). Вызовы не должны пересекаться
+	snapshot_result compact();
+
+	inline size_t wal_bytes() const { return wal_ ? wal_->size_bytes() : 0; }
+	inline bool   wal_failed() const { return wal_ && wal_->failed(); }
+
+	// Снимок целиком перенесён в деревья шардов
+	inline bool base_loaded() const { return base_merged_.load(std::memory_order_acquire); }
+	void wait_base_loaded();
 
 	inline counters& get_stats() { return stats; }
+	inline size_t shard_count() const { return shards_.size(); }
 
 private:
-	void load_into(map& m);
+	struct alignas(64) shard {          // своя кэш-линия на шард — без false sharing
+		std::atomic<const map*> current{ nullptr }; // читается внутри эпохи
+		std::mutex              write_mutex;        // писатели шарда — по очереди, без повторов CAS
+	};
+
+	size_t shard_index(std::string_view key) const;
+	inline shard& shard_for(std::string_view key) { return shards_[shard_index(key)]; }
+
+	// Под write_mutex: ставит новую версию, старую — на отложенное удаление
+	static void publish(shard& s, map next);
+
+	template<class t_map>
+	static entry_ptr updated_entry(const t_map& m, const std::string& key, std::string value);
+
+	// изменение ключа для дельты; entry == nullptr — ключ удалён
+	using change = std::pair<const std::string*, const entry*>;
+
+	// Ключ из снимка, ещё не перенесённый в дерево: ставит его в шард; nullptr — нет
+	entry_ptr load_base(std::string_view key);
+	void merge_base();                  // поток base_merger_
+
+	void load();
+	bool load_mapped(std::vector<map::transient_type>& t, uint64_t& delta_seq);
+	void load_stream(std::vector<map::transient_type>& t, uint64_t& delta_seq);
+	size_t write_snapshot(const std::vector<map>& snaps, uint64_t delta_seq);
+	size_t write_delta(const std::vector<change>& changes, uint64_t seq);
+	void drop_deltas(uint64_t last);
+
+	inline std::string wal_base() const { return file_ + ".wal"; }
+	inline std::string delta_base() const { return file_ + ".delta"; }
 
 	std::string file_;
-	atom root_;                         // lock-free хранилище
-	std::atomic<bool> dirty_{ false };
+	std::vector<shard> shards_;         // размер фиксирован в конструкторе
+
+	// MULTI_SET по нескольким шардам: нечётный batch_seq_ — идёт публикация пакета
+	std::mutex            batch_mutex_; // такие пакеты — по одному
+	std::atomic<uint64_t> batch_seq_{ 0 };
+	wal_config wal_config_;
+	std::unique_ptr<write_ahead_log> wal_;
+
+	// последнее записанное на диск состояние шардов — база для immer::diff;
+	// трогают только load() и compact()
+	std::vector<map> flushed_;
+	uint64_t delta_seq_ = 0;            // номер последней дельты
+	size_t deltas_since_full_ = 0;
+
+	// снимок версии 2, пока его ключи не перенесены в деревья
+	std::unique_ptr<snapshot_index> base_;
+	std::unordered_set<std::string, key_hash, std::equal_to<>> base_erased_;  // удалены дельтами
+	std::atomic<bool> base_merged_{ true };
+	std::atomic<bool> stop_merge_{ false };
+	std::mutex base_mutex_;
+	std::condition_variable base_done_;
+	std::thread base_merger_;
+
 	counters stats;            // статистика запросов
 };
+
+template<class F>
+bool config_store::get(std::string_view key, F&& visit) {
+	epoch_domain::guard guard;
+	const map* snap = shard_for(key).current.load(std::memory_order_seq_cst);
+	const entry_ptr* found = snap->find(key);
+	entry_ptr loaded;                   // ключ из снимка, которого ещё нет в дереве
+	if(found == nullptr) {
+		if(base_loaded() || !(loaded = load_base(key))) return false;
+		found = &loaded;
+	}
+
+	(*found)->stats().add_read();       // своя ячейка потока у горячего ключа
+	stats.add_get();
+	visit(*found);
+	return true;
+}
+
+template<class F>
+void config_store::get_many(const std::vector<std::string_view>& keys, F&& visit) {
+	epoch_domain::guard guard;
+	std::vector<size_t> index(keys.size());
+	for(size_t i = 0; i < keys.size(); ++i)
+		index[i] = shard_index(keys[i]);
+
+	// снимки нужных шардов — между двумя чтениями batch_seq_ без пакета посередине:
+	// MULTI_SET по нескольким шардам виден целиком или не виден вовсе
+	std::vector<const map*> snaps(shards_.size(), nullptr);
+	for(;;) {
+		const uint64_t seq = batch_seq_.load(std::memory_order_seq_cst);
+		if(seq & 1) {
+			std::this_thread::yield();  // пакет публикуется — это несколько замен указателя
+			continue;
+		}
+		for(const size_t s : index)
+			snaps[s] = shards_[s].current.load(std::memory_order_seq_cst);
+		if(batch_seq_.load(std::memory_order_seq_cst) == seq) break;
+	}
+
+	for(size_t i = 0; i < keys.size(); ++i) {
+		const entry_ptr* found = snaps[index[i]]->find(keys[i]);
+		entry_ptr loaded;
+		if(found == nullptr && !base_loaded() && (loaded = load_base(keys[i])))
+			found = &loaded;
+		if(found == nullptr) {
+			visit(i, static_cast<const entry_ptr*>(nullptr));
+			continue;
+		}
+
+		(*found)->stats().add_read();
+		stats.add_get();
+		visit(i, found);
+	}
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Память на простаивающее соединение: N соединений делают по одному GET и держатся
+# открытыми. Через IDLE_TRIM_DELAY простоя выходной буфер уходит в пул, и сервер
+# должен занимать не больше N * 16 KB (приёмное кольцо) + SLACK_KB
+# usage: connection_scaling.sh <server> <client> [N]
+set -e
+
+SERVER=$1
+CLIENT=$2
+N=${3:-256}
+SLACK_KB=64
+
+PORT=${TEST_PORT:-9101}
+DIR=$(mktemp -d)
+trap 'rc=$?; { kill $pid && wait $pid; } 2>/dev/null || true; rm -rf "$DIR"; exit $rc' EXIT
+
+# статистика печатается раз в 5 с — соединения держатся дольше первого вывода
+(cd "$DIR" && exec stdbuf -oL "$SERVER" --port=$PORT --threads=2 > server.log 2>&1) &
+pid=$!
+sleep 1
+"$CLIENT" --port=$PORT --connections=$N --threads=2 --commands=1 --set-percent=0 --hold-ms=7000 > "$DIR/client.log" 2>&1
+
+connected=$(grep -c '^Connected to server' "$DIR/client.log" || true)
+answered=$(sed -n 's/^Responses: \([0-9]*\).*/\1/p' "$DIR/client.log")
+in_use=$(grep -m1 '^\[Buffers\] in use:' "$DIR/server.log" | awk '{ print $4 }')
+limit=$((N * 16 + SLACK_KB))
+
+echo "connections: $connected/$N | responses: ${answered:-?} | in use: ${in_use:-?} KB | limit: $limit KB"
+[ "$connected" -eq "$N" ] || cat "$DIR/server.log" "$DIR/client.log" | grep -v '^Connect' | tail -5
+[ "$connected" -eq "$N" ] && [ "${answered:-0}" -eq "$N" ] && [ -n "$in_use" ] && [ "$in_use" -le "$limit" ]
@@ -0,0 +1,174 @@
+#include "epoch.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+struct alignas(64) epoch_slot
+{
+	std::atomic<epoch_domain::epoch_t> epoch{ 0 };
+	std::atomic<bool>                  used{ false };
+	std::uint32_t                      depth = 0;     // трогает только владелец
+
+	// Отложенные потоком-владельцем. Своя линия: retire не задевает epoch читателя.
+	// Мьютекс без конкуренции — чужой поток берёт его только в reclaim()
+	alignas(64) std::mutex             retired_mutex;
+	std::vector<epoch_domain::retired> retired;
+};
+
+namespace
+{
+	std::array<epoch_slot, epoch_domain::MAX_THREADS> slots;
+
+	void free_all(std::vector<epoch_domain::retired>& freed)
+	{
+		for(auto& r : freed)
+			r.deleter(r.ptr);
+	}
+}
+
+// Слот закрепляется за потоком при первом обращении и освобождается при его выходе
+struct epoch_domain::slot_owner
+{
+	epoch_slot* s = nullptr;
+
+	slot_owner()
+	{
+		for(auto& candidate : slots) {
+			bool expected = false;
+			if(!candidate.used.load(std::memory_order_relaxed)
+				&& candidate.used.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+				s = &candidate;
+				return;
+			}
+		}
+		throw std::runtime_error("epoch_domain: too many reader threads");
+	}
+
+	~slot_owner()
+	{
+		s->epoch.store(0, std::memory_order_release);
+
+		// недоосвобождённое уходит в общий остаток: поток больше не сдвинет эпоху за него
+		std::vector<retired> left;
+		{
+			std::lock_guard lock(s->retired_mutex);
+			left.swap(s->retired);
+		}
+		if(!left.empty()) {
+			auto& domain = instance();
+			std::lock_guard lock(domain.mutex_);
+			domain.orphaned_.insert(domain.orphaned_.end(), left.begin(), left.end());
+		}
+
+		s->used.store(false, std::memory_order_release);
+	}
+};
+
+epoch_domain& epoch_domain::instance()
+{
+	static epoch_domain domain;
+	return domain;
+}
+
+epoch_domain::~epoch_domain()
+{
+	// читателей уже нет
+	free_all(orphaned_);
+	for(auto& s : slots)
+		free_all(s.retired);
+}
+
+epoch_slot* epoch_domain::local_slot()
+{
+	thread_local slot_owner owner;
+	return owner.s;
+}
+
+epoch_domain::guard::guard()
+	: slot_(instance().local_slot())
+{
+	if(slot_->depth++ == 0) {
+		// seq_cst: чтение эпохи и запись слота упорядочены до чтения указателя на версию —
+		// писатель, заменивший указатель позже, пометит старую версию не раньше этой эпохи
+		// и увидит этот слот при обходе
+		slot_->epoch.store(instance().global_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+	}
+}
+
+epoch_domain::guard::~guard()
+{
+	if(--slot_->depth == 0)
+		slot_->epoch.store(0, std::memory_order_release);
+}
+
+void epoch_domain::retire(void* p, void (*deleter)(void*))
+{
+	// метка — текущая эпоха без сдвига: читатель с той же эпохой мог войти до
+	// замены, поэтому версия ждёт, пока все активные не окажутся позже метки
+	const epoch_t epoch = global_.load(std::memory_order_seq_cst);
+	epoch_slot* slot = local_slot();
+
+	std::vector<retired> freed;
+	{
+		std::lock_guard lock(slot->retired_mutex);
+		slot->retired.push_back({ epoch, p, deleter });
+		if(slot->retired.size() >= RECLAIM_BATCH)
+			collect(slot->retired, advance(), freed);
+	}
+
+	free_all(freed);
+}
+
+void epoch_domain::reclaim()
+{
+	const epoch_t oldest = advance();
+
+	std::vector<retired> freed;
+	for(auto& s : slots) {
+		if(!s.used.load(std::memory_order_acquire)) continue;
+
+		std::lock_guard lock(s.retired_mutex);
+		collect(s.retired, oldest, freed);
+	}
+	{
+		std::lock_guard lock(mutex_);
+		collect(orphaned_, oldest, freed);
+	}
+
+	free_all(freed);
+}
+
+std::size_t epoch_domain::retired_count()
+{
+	std::size_t count = 0;
+	for(auto& s : slots) {
+		std::lock_guard lock(s.retired_mutex);
+		count += s.retired.size();
+	}
+
+	std::lock_guard lock(mutex_);
+	return count + orphaned_.size();
+}
+
+epoch_domain::epoch_t epoch_domain::advance()
+{
+	global_.fetch_add(1, std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	epoch_t oldest = std::numeric_limits<epoch_t>::max();
+	for(const auto& s : slots) {
+		const epoch_t e = s.epoch.load(std::memory_order_acquire);
+		if(e != 0) oldest = std::min(oldest, e);
+	}
+	return oldest;
+}
+
+void epoch_domain::collect(std::vector<retired>& list, epoch_t oldest, std::vector<retired>& freed)
+{
+	// версия с меткой t свободна, если все активные читатели вошли в эпоху > t
+	auto it = std::partition(list.begin(), list.end(),
+		[oldest](const retired& r) { return r.epoch >= oldest; });
+	freed.insert(freed.end(), it, list.end());
+	list.erase(it, list.end());
+}
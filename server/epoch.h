@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Эпохи для чтения без блокировок (EBR).
+// Читатель на время чтения публикует текущую эпоху в своём слоте — своя
+// кэш-линия, больше он ничего общего не пишет. Писатель, заменив указатель,
+// откладывает удаление старой версии (retire) с меткой эпохи; версия
+// освобождается, когда все активные читатели вошли позже этой метки.
+// Отложенные копятся в списке своего потока (рядом со слотом), без общего
+// мьютекса; глобальная эпоха сдвигается раз на RECLAIM_BATCH отложенных —
+// тем же обходом слотов, что освобождает накопленное.
+// -----------------------------------------------------------------------------
+struct epoch_slot;
+
+class epoch_domain
+{
+public:
+	using epoch_t = std::uint64_t;
+
+	static constexpr std::size_t MAX_THREADS   = 256; // потоков-читателей одновременно
+	static constexpr std::size_t RECLAIM_BATCH = 64;  // сколько копить отложенных в потоке до обхода слотов
+
+	static epoch_domain& instance();
+
+	~epoch_domain();
+
+	// Читатель внутри guard видит только ещё не освобождённые версии. Вложенность допустима
+	class guard
+	{
+	public:
+		guard();
+		~guard();
+
+		guard(const guard&) = delete;
+		guard& operator=(const guard&) = delete;
+
+	private:
+		epoch_slot* slot_;
+	};
+
+	// Вызывать после публикации замены: p удалится, когда его не сможет видеть ни один читатель
+	template<class T>
+	void retire(const T* p)
+	{
+		retire(const_cast<T*>(p), [](void* q) { delete static_cast<T*>(q); });
+	}
+
+	void retire(void* p, void (*deleter)(void*));
+
+	// Освободить всё, что уже никто не видит, — во всех потоках
+	void reclaim();
+
+	std::size_t retired_count();
+
+	struct retired
+	{
+		epoch_t epoch;
+		void*   ptr;
+		void  (*deleter)(void*);
+	};
+
+private:
+	epoch_domain() = default;
+
+	struct slot_owner;
+
+	epoch_slot* local_slot();
+
+	// Сдвигает эпоху и возвращает самую старую из активных читателей
+	epoch_t advance();
+
+	// Переносит из list во freed всё, что старше oldest
+	static void collect(std::vector<retired>& list, epoch_t oldest, std::vector<retired>& freed);
+
+	std::atomic<epoch_t>  global_{ 1 };   // 0 в слоте — «не читает»
+	std::mutex            mutex_;
+	std::vector<retired>  orphaned_;      // остаток завершившихся потоков, под mutex_
+};
@@ -0,0 +1,69 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::shared_ptr<const mapped_file> mapped_file::open(const std::string& path)
+{
+	std::shared_ptr<mapped_file> file(new mapped_file());
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(handle == INVALID_HANDLE_VALUE) return nullptr;
+
+	LARGE_INTEGER size{};
+	if(!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+		CloseHandle(handle);
+		return nullptr;
+	}
+
+	file->mapping_ = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(handle);                // отображение держит файл само
+	if(!file->mapping_)
+		throw std::runtime_error("Failed to map " + path);
+
+	file->data_ = static_cast<const char*>(MapViewOfFile(file->mapping_, FILE_MAP_READ, 0, 0, 0));
+	if(!file->data_)
+		throw std::runtime_error("Failed to map " + path);
+	file->size_ = static_cast<std::size_t>(size.QuadPart);
+#else
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) return nullptr;
+
+	struct stat st{};
+	if(fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return nullptr;
+	}
+
+	void* data = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);                        // отображение держит файл само
+	if(data == MAP_FAILED)
+		throw std::runtime_error("Failed to map " + path);
+
+	file->data_ = static_cast<const char*>(data);
+	file->size_ = static_cast<std::size_t>(st.st_size);
+#endif
+
+	return file;
+}
+
+mapped_file::~mapped_file()
+{
+#ifdef _WIN32
+	if(data_) UnmapViewOfFile(data_);
+	if(mapping_) CloseHandle(mapping_);
+#else
+	if(data_) munmap(const_cast<char*>(data_), size_);
+#endif
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// -----------------------------------------------------------------------------
+// Файл, отображённый в память только для чтения (mmap / MapViewOfFile).
+// Страницы подгружаются ОС при первом обращении: открыть файл любого размера —
+// несколько системных вызовов. Отображение живёт, пока жив последний shared_ptr;
+// на POSIX файл можно тем временем заменить rename — отображение останется
+// на старом содержимом.
+// -----------------------------------------------------------------------------
+class mapped_file
+{
+public:
+	// nullptr — файла нет или он пуст
+	static std::shared_ptr<const mapped_file> open(const std::string& path);
+
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	inline const char* data() const { return data_; }
+	inline std::size_t size() const { return size_; }
+
+private:
+	mapped_file() = default;
+
+	const char* data_ = nullptr;
+	std::size_t size_ = 0;
+#ifdef _WIN32
+	void*       mapping_ = nullptr;
+#endif
+};
+
+// Значение, которое лежит в отображённом снимке; crc — для проверки при чтении
+struct mapped_value
+{
+	std::shared_ptr<const mapped_file> file;
+	std::string_view                   bytes;
+	std::uint32_t                      crc = 0;
+};
@@ -0,0 +1,43 @@
+#include "response_cache.h"
+
+response_cache& response_cache::instance()
+{
+	static response_cache cache;
+	return cache;
+}
+
+const prepared_get_response* response_cache::lookup(std::string_view key, const entry_ptr& e)
+{
+	if(const auto* r = e->response.load(std::memory_order_acquire))
+		return r;                                // кадр живёт, пока жива версия
+
+	// без счётчиков по ключам горячесть не измерить — строим сразу
+	if constexpr(key_stats::enabled) {
+		if(e->stats().reads() - e->reads_base < config_.hot_reads)
+			return nullptr;
+	}
+
+	// бюджет резервируется до построения: гонка строителей не выходит за предел
+	const std::size_t size = codec::FRAME_HEADER_SIZE
+		+ codec::static_size<get_command_response>() + key.size() + e->value().size();
+	if(size > MAX_MESSAGE_SIZE)
+		return nullptr;                          // такой кадр не отправить: обычный путь ответит отказом
+	if(used_.fetch_add(size, std::memory_order_relaxed) + size > config_.budget) {
+		used_.fetch_sub(size, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	const auto* built = new prepared_get_response(key, e->value());
+	const prepared_get_response* expected = nullptr;
+	if(!e->response.compare_exchange_strong(expected, built, std::memory_order_acq_rel)) {
+		release(built);                          // другой поток успел первым
+		built = expected;
+	}
+	return built;
+}
+
+void response_cache::release(const prepared_get_response* r)
+{
+	used_.fetch_sub(r->size(), std::memory_order_relaxed);
+	delete r;
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "config_store.h"
+
+struct response_caching
+{
+	std::size_t   budget    = 64 * 1024 * 1024; // байт под готовые ответы; 0 — не кэшировать
+	std::uint64_t hot_reads = 4;                // кадр строится после стольких GET версии
+};
+
+// -----------------------------------------------------------------------------
+// Кэш готовых ответов на GET.
+// Кадр привязан к версии значения (entry::response) и умирает вместе с ней,
+// поэтому SET ничего не инвалидирует явно: новая версия начинает без кадра.
+// Кадр строится только для горячих версий и только пока хватает бюджета.
+// -----------------------------------------------------------------------------
+class response_cache
+{
+public:
+	static response_cache& instance();
+
+	// До запуска io-потоков
+	void configure(const response_caching& config) { config_ = config; }
+
+	// Готовый кадр для версии или nullptr — тогда ответ собирается как обычно.
+	// Кадр принадлежит версии: годен, пока e удерживается (внутри эпохи или по entry_ptr)
+	const prepared_get_response* lookup(std::string_view key, const entry_ptr& e);
+
+	// Из entry::~entry()
+	void release(const prepared_get_response* r);
+
+	inline std::size_t used_bytes() const { return used_.load(std::memory_order_relaxed); }
+
+private:
+	response_cache() = default;
+
+	response_caching         config_;
+	std::atomic<std::size_t> used_{ 0 };
+};
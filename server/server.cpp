@@ -1,73 +1,279 @@
 #include <boost/asio.hpp>
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <thread>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "config_store.h"
+#include "response_cache.h"
 #include "server_dispatcher.h"
+#include "snapshot_writer.h"
+#include "store_bench.h"
+#include "write_combiner.h"
+#include <co_connection.h>
 #include <connection.h>
+#include <options.h>
 
 class config_store;
 namespace asio = boost::asio;
 using boost::system::error_code;
 using tcp = asio::ip::tcp;
 
-using connection = t_connection<server_dispatcher>;
-using connection_ptr = std::shared_ptr<connection>;
+// Модель исполнения:
+//   pool     — один io_context на --threads потоков, общий acceptor, strand на соединение;
+//   per-core — io_context и acceptor (SO_REUSEPORT) на каждый поток, соединение
+//              живёт в потоке, принявшем его, и обходится без strand
+enum class runtime_model
+{
+	pool,
+	per_core,
+};
+
+using pool_connection    = t_connection<server_dispatcher, strand_executor>;
+using core_connection    = t_connection<server_dispatcher, inline_executor>;
+using pool_co_connection = t_co_connection<server_dispatcher, strand_executor>;  // --connection=coroutine
+using core_co_connection = t_co_connection<server_dispatcher, inline_executor>;
+
+// -----------------------------------------------------------------------------
+// Настройки сервера (из командной строки)
+// -----------------------------------------------------------------------------
+struct server_config
+{
+	std::uint16_t        port         = 9000;
+	std::size_t          threads      = std::thread::hardware_concurrency();
+	runtime_model        runtime      = runtime_model::pool;
+	bool                 pin_cores    = false; // per-core: привязать поток i к ядру i
+	bool                 coroutines   = false; // соединения на корутинах (t_co_connection)
+	std::chrono::microseconds busy_poll{ 0 };        // > 0 — io-поток столько крутит poll(), прежде чем уснуть
+	std::chrono::microseconds socket_busy_poll{ 0 }; // > 0 — SO_BUSY_POLL на принятых сокетах (Linux)
+	flow_control         flow{ .pause_reads = true, .read_budget = DEFAULT_READ_BUDGET }; // медленный читатель перестаёт читаться, а не раздувает очередь
+	std::chrono::seconds idle_timeout = DEFAULT_IDLE_TIMEOUT;
+	std::size_t          shards       = DEFAULT_SHARD_COUNT;
+	write_combining      writes;
+	response_caching     responses;
+	wal_config           wal;
+	std::size_t          bench_set    = 0;    // > 0 — замерить SET хранилища (операций на поток) и выйти
+	std::size_t          bench_get    = 0;    // > 0 — то же для GET
+
+	explicit server_config(const options& opts)
+	{
+		port                = opts.get("port", port);
+		threads             = std::max<std::size_t>(opts.get("threads", threads), 1);
+		runtime             = parse_runtime(opts.get<std::string>("runtime", "pool"));
+		pin_cores           = opts.get("pin-cores", pin_cores);
+		coroutines          = parse_connection(opts.get<std::string>("connection", "callback"));
+		busy_poll           = std::chrono::microseconds(opts.get("busy-poll-us", busy_poll.count()));
+		socket_busy_poll    = std::chrono::microseconds(opts.get("socket-busy-poll-us", socket_busy_poll.count()));
+		flow.low_watermark  = opts.get("low-watermark", flow.low_watermark);
+		flow.high_watermark = opts.get("high-watermark", flow.high_watermark);
+		flow.credit_window  = opts.get("credit-window", flow.credit_window);
+		flow.read_budget    = opts.get("read-budget", flow.read_budget);
+		idle_timeout        = std::chrono::seconds(opts.get("idle-timeout", idle_timeout.count()));
+		shards              = opts.get("shards", shards);
+		writes.max_batch    = opts.get("set-batch", writes.max_batch);
+		writes.max_delay    = std::chrono::microseconds(opts.get("set-delay-us", writes.max_delay.count()));
+		responses.budget    = opts.get("response-cache-mb", responses.budget / (1024 * 1024)) * 1024 * 1024;
+		responses.hot_reads = opts.get("response-cache-hot", responses.hot_reads);
+		wal.fsync           = parse_fsync(opts.get<std::string>("wal-fsync", "interval"));
+		wal.interval        = std::chrono::milliseconds(opts.get("wal-fsync-ms", wal.interval.count()));
+		wal.compact_bytes   = opts.get("wal-compact-mb", wal.compact_bytes / (1024 * 1024)) * 1024 * 1024;
+		wal.full_every      = opts.get("snapshot-full-every", wal.full_every);
+		bench_set           = opts.get("bench-set", bench_set);
+		bench_get           = opts.get("bench-get", bench_get);
+	}
+
+	static runtime_model parse_runtime(const std::string& name)
+	{
+		if(name == "pool")     return runtime_model::pool;
+		if(name == "per-core") return runtime_model::per_core;
+		throw std::invalid_argument("bad value for --runtime: " + name);
+	}
+
+	static bool parse_connection(const std::string& name)
+	{
+		if(name == "callback")  return false;
+		if(name == "coroutine") return true;
+		throw std::invalid_argument("bad value for --connection: " + name);
+	}
+
+	static fsync_policy parse_fsync(const std::string& name)
+	{
+		if(name == "never")    return fsync_policy::never;
+		if(name == "interval") return fsync_policy::interval;
+		if(name == "always")   return fsync_policy::always;
+		throw std::invalid_argument("bad value for --wal-fsync: " + name);
+	}
+};
 
 // -----------------------------------------------------------------------------
 // Одна клиентская сессия
 // -----------------------------------------------------------------------------
-class session : public std::enable_shared_from_this<session>
+template<class t_connection_type>
+class t_session : public std::enable_shared_from_this<t_session<t_connection_type>>
 {
 public:
-	explicit session(asio::io_context& io, tcp::socket sock, config_store& store)
-		: dispatcher_(store), conn_(std::make_shared<connection>(io, std::move(sock), dispatcher_))
-	{}
+	explicit t_session(asio::io_context& io, tcp::socket sock, config_store& store, write_combiner& writes, timer_wheel& wheel,
+		const server_config& config)
+		: dispatcher_(store, writes), conn_(std::make_shared<t_connection_type>(io, std::move(sock), dispatcher_, wheel))
+	{
+		conn_->set_flow_control(config.flow);
+		conn_->set_idle_timeout(config.idle_timeout);
+	}
 
-	~session()
+	~t_session()
 	{
 		std::cout << "Session closed\n";
 	}
 
-	void start() { conn_->read(shared_from_this()); }
+	void start() { conn_->read(this->shared_from_this()); }
 
 private:
-	server_dispatcher dispatcher_;
-	connection_ptr    conn_;
+	server_dispatcher                  dispatcher_;
+	std::shared_ptr<t_connection_type> conn_;
+};
+
+// -----------------------------------------------------------------------------
+// Приём соединений на одном io_context. Сессии живут на том же io_context;
+// колесо простоя — своё, чтобы его обход не уходил в чужой поток
+// -----------------------------------------------------------------------------
+template<class t_connection_type>
+class t_listener
+{
+public:
+	t_listener(asio::io_context& io, const server_config& config, config_store& store, write_combiner& writes, bool reuse_port)
+		: acceptor_(io)
+		, config(config)
+		, store(store)
+		, writes_(writes)
+		, wheel_(io)
+		, io(io)
+	{
+		const tcp::endpoint endpoint(tcp::v4(), config.port);
+		acceptor_.open(endpoint.protocol());
+		acceptor_.set_option(tcp::acceptor::reuse_address(true));
+		if(reuse_port)
+			set_reuse_port();
+#ifndef SO_BUSY_POLL
+		if(config.socket_busy_poll.count() > 0)
+			throw std::runtime_error("--socket-busy-poll-us needs SO_BUSY_POLL");
+#endif
+		acceptor_.bind(endpoint);
+		acceptor_.listen();
+
+		do_accept();
+	}
+
+private:
+	// Несколько acceptor на одном порту: ядро раздаёт им входящие соединения
+	void set_reuse_port()
+	{
+#ifdef SO_REUSEPORT
+		acceptor_.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#else
+		throw std::runtime_error("--runtime=per-core needs SO_REUSEPORT");
+#endif
+	}
+
+	// Ядро само опрашивает очередь сетевой карты при чтении из сокета, пока не
+	// истечёт время, — короче путь пакета до потока (нужен CAP_NET_ADMIN, если
+	// значение больше net.core.busy_read)
+	void set_busy_poll(tcp::socket& socket)
+	{
+#ifdef SO_BUSY_POLL
+		error_code ec;
+		socket.set_option(asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>(
+			static_cast<int>(config.socket_busy_poll.count())), ec);
+
+		static std::atomic<bool> warned{ false };
+		if(ec && !warned.exchange(true))
+			std::cerr << "Failed to set SO_BUSY_POLL: " << ec.message() << '\n';
+#endif
+	}
+
+	void do_accept()
+	{
+		acceptor_.async_accept(
+			[this](error_code ec, tcp::socket socket)
+		{
+			if(!ec && config.socket_busy_poll.count() > 0)
+				set_busy_poll(socket);
+
+			if(!ec)
+				std::make_shared<t_session<t_connection_type>>(io, std::move(socket), store, writes_, wheel_, config)->start();
+			else
+				std::cerr << "Accept error: " << ec.message() << '\n';
+
+			do_accept(); // ждём следующий коннект
+		});
+	}
+
+	tcp::acceptor        acceptor_;
+	const server_config& config;
+	config_store&        store;
+	write_combiner&      writes_;
+	timer_wheel          wheel_;      // простой соединений этого io_context — один таймер
+	asio::io_context&    io;
 };
 
 // -----------------------------------------------------------------------------
-// Аcceptor
+// Общие службы сервера: таймеры, объединение SET, снимки.
+// Соединения принимают t_listener — один или по одному на ядро
 // -----------------------------------------------------------------------------
 class server
 {
 public:
-	server(asio::io_context& io, std::uint16_t port, config_store& store)
-		: acceptor_(io, tcp::endpoint(tcp::v4(), port))
+	server(asio::io_context& io, const server_config& config, config_store& store)
+		: config(config)
 		, store(store)
 		, save_timer_(io)
 		, stat_timer_(io)
-		, io(io)
+		, writes_(io, store, config.writes)
+		, snapshots_(store)
 	{
-		std::cout << "Server started on port " << port << '\n';
-		do_accept();
 		start_save_timer(); // Запускаем таймер для периодического сохранения
 		start_stat_timer(); // Запускаем таймер для периодической печати статистики
 	}
 
+	inline write_combiner& writes() { return writes_; }
+
 private:
 	void save_store()
 	{
-		if(store.flush_if_dirty())
-			std::cout << "Store saved to disk.\n";
+		snapshots_.request(); // снимок пишет свой поток; здесь только запрос
 	}
 
 	void print_stat()
 	{
 		auto& stats = store.get_stats();
 		stats.dump_and_reset();
+		epoch_domain::instance().reclaim(); // версии, отложенные после последнего SET
+
+		if(writes_.enabled() && writes_.batches() > 0)
+			std::cout << "[Writes] batches: " << writes_.batches()
+				<< " | SET per batch: " << writes_.combined() / writes_.batches() << '\n';
+
+		auto& pool = buffer_pool::instance();
+		std::cout << "[Buffers] in use: " << pool.in_use_bytes() / 1024
+			<< " KB | cached: " << pool.cached_bytes() / 1024
+			<< " KB | responses: " << response_cache::instance().used_bytes() / 1024
+			<< " KB | WAL: " << store.wal_bytes() / 1024 << " KB\n";
+
+		const auto snap = snapshots_.stats();
+		if(snap.written + snap.failed > 0)
+			std::cout << "[Snapshots] written: " << snap.written << " | failed: " << snap.failed
+				<< " | last: " << (snap.last_full ? "full, " : "delta, ") << snap.last_changes << " keys, "
+				<< snap.last_duration.count() << " ms, " << snap.last_bytes / 1024 << " KB\n";
 	}
 	
 	void start_stat_timer()
@@ -91,48 +297,125 @@ private:
 			}
 		});
 	}
-	
-	void do_accept()
-	{
-		acceptor_.async_accept(
-			[this](error_code ec, tcp::socket socket)
-		{
-			if(!ec)
-				std::make_shared<session>(io, std::move(socket), store)->start();
-			else
-				std::cerr << "Accept error: " << ec.message() << '\n';
 
-			do_accept(); // ждём следующий коннект
-		});
+	const server_config& config;
+	config_store&        store;
+	asio::steady_timer   save_timer_;
+	asio::steady_timer   stat_timer_;
+	write_combiner       writes_;     // объединение SET в пачки (--set-batch)
+	snapshot_writer      snapshots_;  // снимки — в своём потоке, io-потоки диск не ждут
+};
+
+// Цикл io-потока. Без --busy-poll-us — обычный run(): поток спит в epoll или
+// futex, и каждый запрос платит за пробуждение. С ним поток, не найдя работы,
+// ещё spin крутит неблокирующий poll() и засыпает в run_one(), только если
+// за это время ничего не пришло
+static void run_io(asio::io_context& io, std::chrono::microseconds spin)
+{
+	if(spin.count() == 0) {
+		io.run();
+		return;
 	}
 
-	tcp::acceptor      acceptor_;
-	config_store&      store;
-	asio::steady_timer save_timer_;
-	asio::steady_timer stat_timer_;
-	asio::io_context&  io;
-};
+	using clock = std::chrono::steady_clock;
+	while(!io.stopped()) {
+		if(io.poll() > 0) continue;
+
+		const auto deadline = clock::now() + spin;
+		std::size_t handled = 0;
+		while(handled == 0 && !io.stopped() && clock::now() < deadline)
+			handled = io.poll();
+
+		if(handled == 0 && !io.stopped())
+			io.run_one();
+	}
+}
+
+// Привязать текущий поток к ядру (best effort: ошибка — только предупреждение)
+static void pin_to_core(std::size_t core)
+{
+#ifdef _WIN32
+	if(!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core))
+		std::cerr << "Failed to pin thread to core " << core << '\n';
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % CPU_SETSIZE, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		std::cerr << "Failed to pin thread to core " << core << '\n';
+#endif
+}
+
+// Общий пул: один io_context, один acceptor, strand на соединение
+template<class t_connection_type>
+void run_pool(const server_config& config, config_store& store)
+{
+	asio::io_context io;
+	server srv(io, config, store);
+	t_listener<t_connection_type> listener(io, config, store, srv.writes(), false);
+	std::cout << "Server started on port " << config.port << " (" << config.threads << " threads, shared pool"
+		<< (config.coroutines ? ", coroutines" : "")
+		<< (config.busy_poll.count() > 0 ? ", busy-poll" : "") << ")\n";
+
+	// --threads=1 — классическая однопоточная «async I/O», по умолчанию — пул по числу ядер
+	std::vector<std::thread> pool;
+	for(std::size_t i = 0; i < config.threads; ++i)
+		pool.emplace_back([&io, &config] { run_io(io, config.busy_poll); });
+
+	for(auto& t : pool) t.join();
+}
+
+// Поток на ядро: свой io_context и acceptor; таймеры и объединение SET — на первом
+template<class t_connection_type>
+void run_per_core(const server_config& config, config_store& store)
+{
+	std::vector<std::unique_ptr<asio::io_context>> cores;
+	for(std::size_t i = 0; i < config.threads; ++i)
+		cores.push_back(std::make_unique<asio::io_context>(1)); // подсказка: поток один
+
+	server srv(*cores[0], config, store);
+
+	std::vector<std::unique_ptr<t_listener<t_connection_type>>> listeners;
+	for(auto& io : cores)
+		listeners.push_back(std::make_unique<t_listener<t_connection_type>>(*io, config, store, srv.writes(), true));
+	std::cout << "Server started on port " << config.port << " (" << config.threads << " threads, per-core"
+		<< (config.pin_cores ? ", pinned" : "") << (config.coroutines ? ", coroutines" : "")
+		<< (config.busy_poll.count() > 0 ? ", busy-poll" : "") << ")\n";
+
+	std::vector<std::thread> threads;
+	for(std::size_t i = 0; i < cores.size(); ++i)
+		threads.emplace_back([&config, &io = *cores[i], i] {
+			if(config.pin_cores) pin_to_core(i);
+			run_io(io, config.busy_poll);
+		});
+
+	for(auto& t : threads) t.join();
+}
 
 // -----------------------------------------------------------------------------
 // main
 // -----------------------------------------------------------------------------
-int main()
+int main(int argc, char* argv[])
 {
 	try
 	{
-		asio::io_context io;
-		config_store store("config.dat"); // Путь к файлу конфигурации
-		server srv(io, 9000, store);
+		const server_config config{ options(argc, argv) };
 
-		// ───── Выбираем модель параллелизма ─────
-		//const std::size_t threads = 1;          // ← 1 = классическая однопоточная «async I/O»
-		const std::size_t threads = std::thread::hardware_concurrency(); // ← включить пул
+		if(config.bench_set > 0 || config.bench_get > 0) {
+			if(config.bench_set > 0) run_store_bench(config.threads, config.shards, config.bench_set);
+			if(config.bench_get > 0) run_get_bench(config.threads, config.shards, config.bench_get);
+			return 0;
+		}
+
+		response_cache::instance().configure(config.responses);
 
-		std::vector<std::thread> pool;
-		for(std::size_t i = 0; i < threads; ++i)
-			pool.emplace_back([&io] { io.run(); });
+		config_store store("config.dat", config.shards, config.wal); // Путь к файлу конфигурации; журнал — config.dat.wal.N
 
-		for(auto& t : pool) t.join();
+		// ───── Выбираем модель параллелизма ─────
+		if(config.runtime == runtime_model::per_core)
+			config.coroutines ? run_per_core<core_co_connection>(config, store) : run_per_core<core_connection>(config, store);
+		else
+			config.coroutines ? run_pool<pool_co_connection>(config, store) : run_pool<pool_connection>(config, store);
 	}
 	catch(const std::exception& e)
 	{
@@ -1,26 +1,76 @@
 ﻿#include "server_dispatcher.h"
 
 #include "config_store.h"
+#include "response_cache.h"
+#include "write_combiner.h"
 
-void server_dispatcher::process(const get_command_ptr& cmd, const i_socket_ptr& socket)
+namespace
 {
-	auto opt = store_.get(cmd->get_key());
-	uint64_t reads = 0;
-	uint64_t writes = 0;
-	std::string value = "not found";
-
-	if(opt) {
-		const auto& [key, entry] = *opt;
-		reads = entry->reads.load();
-		writes = entry->writes.load();
-		value = entry->value;
+	constexpr std::string_view NOT_FOUND = "not found";
+	constexpr std::string_view TOO_LARGE = "response too large";
+
+	// Ответ больше MAX_MESSAGE_SIZE не отправить — клиент вместо него получает отказ
+	// со своим request_id и не ждёт ответа вечно
+	template<class T>
+	void reply(const i_socket_ptr& socket, const T& response)
+	{
+		if(codec::frame_size(response) > MAX_MESSAGE_SIZE)
+			socket->send(error_response{ response.request_id, TOO_LARGE });
+		else
+			socket->send(response);
 	}
+}
+
+// Ответ кодируется прямо в send(), пока мы в эпохе: ключ берётся из кадра запроса,
+// значение — из версии в дереве, без копий и без счётчиков ссылок
+void server_dispatcher::process(const get_command& cmd, const i_socket_ptr& socket)
+{
+	const bool found = store_.get(cmd.key, [&](const entry_ptr& e) {
+		const uint64_t reads = e->stats().reads();
+
+		if(const auto* prepared = response_cache::instance().lookup(cmd.key, e)) { // горячая версия: копия готового кадра и три поля
+			socket->send(*prepared, cmd.request_id, reads, e->version);
+			return;
+		}
+
+		reply(socket, get_command_response{ cmd.key, cmd.request_id, reads, e->version, e->value() });
+	});
+
+	if(!found)
+		socket->send(get_command_response{ cmd.key, cmd.request_id, 0, 0, NOT_FOUND });
+}
+
+void server_dispatcher::process(const set_command& cmd, const i_socket_ptr&)
+{
+	writes_.submit(cmd.key, cmd.value);
+}
+
+void server_dispatcher::process(const multi_get_command& cmd, const i_socket_ptr& socket)
+{
+	const auto& keys = cmd.keys;
+
+	// значения в items — ссылки на версии: эпоха держит их до конца send()
+	epoch_domain::guard guard;
+
+	std::vector<multi_get_command_response::item> items(keys.size());
+	store_.get_many(keys, [&](size_t i, const entry_ptr* e) {
+		auto& item = items[i];
+		item.key = keys[i];
+
+		if(e) {
+			item.reads = (*e)->stats().reads();
+			item.writes = (*e)->version;
+			item.value = (*e)->value();
+		}
+		else {
+			item.value = NOT_FOUND;
+		}
+	});
 
-	get_command_response_ptr response = make_shared<get_command_response>(cmd, value, reads, writes);
-	socket->send(response);
+	reply(socket, multi_get_command_response{ cmd.request_id, std::move(items) });
 }
 
-void server_dispatcher::process(const set_command_ptr& cmd, const i_socket_ptr& socket)
+void server_dispatcher::process(const multi_set_command& cmd, const i_socket_ptr&)
 {
-	store_.set(cmd->get_key(), cmd->get_value());
+	writes_.submit_many(cmd.items); // той же очередью, что SET: порядок записей соединения сохраняется
 }
@@ -3,16 +3,21 @@
 #include <protocol.h>
 
 class config_store;
+class write_combiner;
 
-class server_dispatcher : public i_server_dispatcher
+// final: вызовы из таблицы разбора (read<server_dispatcher>) девиртуализуются
+class server_dispatcher final : public i_server_dispatcher
 {
 public:
-	inline server_dispatcher(config_store& store)
-		: store_(store) {}
+	inline server_dispatcher(config_store& store, write_combiner& writes)
+		: store_(store), writes_(writes) {}
 	
-	void process(const get_command_ptr& cmd, const i_socket_ptr& socket) override;
-	void process(const set_command_ptr& cmd, const i_socket_ptr& socket) override;
+	void process(const get_command& cmd, const i_socket_ptr& socket) override;
+	void process(const set_command& cmd, const i_socket_ptr& socket) override;
+	void process(const multi_get_command& cmd, const i_socket_ptr& socket) override;
+	void process(const multi_set_command& cmd, const i_socket_ptr& socket) override;
 
 private:
-	config_store& store_;
+	config_store&   store_;
+	write_combiner& writes_;
 };
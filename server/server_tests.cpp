@@ -0,0 +1,440 @@
+#include "config_store.h"
+#include "server_dispatcher.h"
+#include "write_combiner.h"
+
+#include <boost/asio.hpp>
+#include <connection.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace fs = std::filesystem;
+using namespace std::chrono_literals;
+
+// -----------------------------------------------------------------------------
+// Проверки сервера без сети: хранилище, объединение записей и диспетчер в
+// одном процессе. server_tests <имя> — одна проверка (так их запускает ctest),
+// без аргументов — все. Код возврата 0 — все условия выполнены.
+// -----------------------------------------------------------------------------
+namespace
+{
+	int failures = 0;
+
+	void check(bool ok, std::string_view what)
+	{
+		if(ok) return;
+		std::cerr << "FAILED: " << what << '\n';
+		++failures;
+	}
+
+	std::string value_of(config_store& store, std::string_view key)
+	{
+		std::string value;
+		store.get(key, [&](const entry_ptr& e) { value = e->value(); });
+		return value;
+	}
+
+	// Временный каталог проверки, удаляется вместе с содержимым
+	struct temp_dir
+	{
+		temp_dir()
+			: path(fs::temp_directory_path() / ("server_tests." + std::to_string(std::random_device{}())))
+		{
+			fs::create_directories(path);
+		}
+
+		~temp_dir()
+		{
+			std::error_code ec;
+			fs::remove_all(path, ec);
+		}
+
+		std::string file(const char* name) const { return (path / name).string(); }
+
+		fs::path path;
+	};
+
+	// Сокет проверки: каждый ответ кодируется в свой кадр, как ушёл бы в сеть
+	class capture_socket final : public i_socket
+	{
+	public:
+		void send(const message& msg) override
+		{
+			std::visit([this](const auto& cmd) {
+				auto& frame = frames.emplace_back(codec::frame_size(cmd));
+				memory_writer writer{ frame };
+				codec::encode_frame(writer, cmd);
+			}, msg);
+		}
+
+		void send_many(std::span<const message> msgs) override
+		{
+			for(const auto& msg : msgs)
+				send(msg);
+		}
+
+		void send(const prepared_get_response& frame, uint16_t request_id, uint64_t reads, uint64_t writes) override
+		{
+			frame.write(frames.emplace_back(frame.size()), request_id, reads, writes);
+		}
+
+		std::vector<std::vector<uint8_t>> frames;
+	};
+
+	// Разобранные ответы сервера: request_id → что пришло (у CREDIT — число кредитов)
+	struct reply_log
+	{
+		void process(const get_command_response& cmd, const i_socket_ptr&) { replies.emplace_back(cmd.request_id, "GET_RESPONSE"); }
+		void process(const multi_get_command_response& cmd, const i_socket_ptr&) { replies.emplace_back(cmd.request_id, "MULTI_GET_RESPONSE"); }
+		void process(const error_response& cmd, const i_socket_ptr&) { replies.emplace_back(cmd.request_id, std::string(cmd.message)); }
+		void process(const credit_command& cmd, const i_socket_ptr&) { replies.emplace_back(cmd.credits, "CREDIT"); }
+
+		explicit reply_log(const std::vector<std::vector<uint8_t>>& frames)
+		{
+			for(const auto& frame : frames) {
+				check(frame.size() <= MAX_MESSAGE_SIZE, "reply fits MAX_MESSAGE_SIZE");
+				read(std::span<const uint8_t>(frame).subspan(sizeof(uint32_t)), *this, nullptr);
+			}
+		}
+
+		uint32_t credits() const
+		{
+			uint32_t total = 0;
+			for(const auto& [n, what] : replies)
+				if(what == "CREDIT") total += n;
+			return total;
+		}
+
+		size_t count(std::string_view what) const
+		{
+			return static_cast<size_t>(std::count_if(replies.begin(), replies.end(), [&](const auto& r) { return r.second == what; }));
+		}
+
+		std::vector<std::pair<uint16_t, std::string>> replies;
+	};
+
+	// SET, а следом MULTI_SET того же ключа с объединением записей: побеждает MULTI_SET
+	void set_then_multi_set()
+	{
+		asio::io_context io;
+		config_store store("");
+		write_combiner writes(io, store, write_combining{ 64, std::chrono::microseconds(1000) });
+		server_dispatcher dispatcher(store, writes);
+
+		dispatcher.process(set_command{ "key", "set" }, nullptr);
+		dispatcher.process(multi_set_command{ { { "key", "multi" }, { "other", "multi" } } }, nullptr);
+		dispatcher.process(set_command{ "other", "set" }, nullptr);
+		io.run();
+
+		check(value_of(store, "key") == "multi", "MULTI_SET after SET of the same key wins");
+		check(value_of(store, "other") == "set", "SET after MULTI_SET of the same key wins");
+	}
+
+	// MULTI_GET, чей ответ больше кадра: вместо молчания — отказ с тем же request_id
+	void oversized_multi_get()
+	{
+		asio::io_context io;
+		config_store store("");
+		write_combiner writes(io, store, write_combining{});
+		server_dispatcher dispatcher(store, writes);
+
+		const std::string big(MAX_MESSAGE_SIZE / 3, 'x');
+		for(const char* key : { "a", "b", "c", "d" })
+			store.set(key, big);
+
+		auto socket = std::make_shared<capture_socket>();
+		dispatcher.process(multi_get_command{ 7, { "a", "b" } }, socket);
+		dispatcher.process(multi_get_command{ 8, { "a", "b", "c", "d" } }, socket);
+		dispatcher.process(get_command{ "a", 9 }, socket);
+
+		const reply_log log(socket->frames);
+		check(log.replies.size() == 3, "one reply per request");
+		if(log.replies.size() != 3) return;
+		check(log.replies[0] == std::pair<uint16_t, std::string>{ 7, "MULTI_GET_RESPONSE" }, "MULTI_GET that fits is answered");
+		check(log.replies[1] == std::pair<uint16_t, std::string>{ 8, "response too large" }, "oversized MULTI_GET gets ERROR_RESPONSE");
+		check(log.replies[2] == std::pair<uint16_t, std::string>{ 9, "GET_RESPONSE" }, "connection keeps answering");
+	}
+
+	// Ошибка записи журнала запрещает SET только до снимка, который её покрывает.
+	// Сегмент после rotate() — ссылка на /dev/full: любая запись в него не удаётся
+	void wal_recovers_after_snapshot()
+	{
+		if(!fs::exists("/dev/full")) {
+			std::cout << "skipped: no /dev/full\n";
+			return;
+		}
+
+		temp_dir dir;
+		const std::string file = dir.file("config.dat");
+		{
+			config_store store(file, 1, wal_config{ fsync_policy::always });
+			store.set("before", "1");
+
+			const auto segments = list_numbered(file + ".wal");
+			check(!segments.empty(), "WAL segment is open");
+			if(segments.empty()) return;
+			fs::create_symlink("/dev/full", file + ".wal." + std::to_string(segments.back().first + 1));
+			store.compact();                // журнал переходит на /dev/full
+
+			store.set("lost", "2");         // опубликован, но в журнал не попал
+			for(int i = 0; i < 200 && !store.wal_failed(); ++i)
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			check(store.wal_failed(), "write to /dev/full fails the WAL");
+			check(store.needs_compaction(), "failed WAL asks for a snapshot");
+
+			bool rejected = false;
+			try { store.set("rejected", "3"); }
+			catch(const std::runtime_error&) { rejected = true; }
+			check(rejected, "SET is rejected after a WAL failure");
+
+			store.compact();                // снимок покрывает "lost", сегмент с ошибкой удалён
+			check(!store.wal_failed(), "snapshot over the failed segment clears the failure");
+			store.set("after", "4");
+			check(value_of(store, "after") == "4", "SET is accepted again");
+		}
+
+		// после перезапуска: "lost" — из снимка, "after" — из нового сегмента
+		config_store reopened(file, 1);
+		check(value_of(reopened, "lost") == "2" && value_of(reopened, "after") == "4", "state survives restart");
+		check(value_of(reopened, "rejected").empty(), "rejected SET was not published");
+	}
+
+	// Снимок версии 2 открывается без построения деревьев: ключи доступны сразу,
+	// SET до конца фонового переноса не затирается значением из снимка
+	void lazy_snapshot_load()
+	{
+		temp_dir dir;
+		const std::string file = dir.file("config.dat");
+		constexpr int KEYS = 20000;
+		{
+			config_store store(file, 4, wal_config{ fsync_policy::never });
+			for(int i = 0; i < KEYS; ++i)
+				store.set("key" + std::to_string(i), "v" + std::to_string(i));
+			check(store.compact().full, "first snapshot is full");
+		}
+
+		{
+			config_store store(file, 4, wal_config{ fsync_policy::never });
+			check(value_of(store, "key7") == "v7", "key is readable right after start");
+			store.set("key8", "new");
+			store.set("fresh", "1");
+
+			std::vector<std::string_view> keys{ "key9", "missing", "key10" };
+			std::vector<std::string> values(keys.size());
+			store.get_many(keys, [&](size_t i, const entry_ptr* e) { if(e) values[i] = (*e)->value(); });
+			check(values == std::vector<std::string>{ "v9", "", "v10" }, "MULTI_GET reads the snapshot index");
+
+			store.wait_base_loaded();
+			check(store.base_loaded(), "snapshot is merged in background");
+			check(value_of(store, "key8") == "new", "SET before the merge survives it");
+			check(value_of(store, "key" + std::to_string(KEYS - 1)) == "v" + std::to_string(KEYS - 1), "last key is merged");
+			check(!store.compact().full, "merged snapshot is the base for a delta");
+		}
+
+		config_store reopened(file, 4, wal_config{ fsync_policy::never });
+		check(value_of(reopened, "key8") == "new" && value_of(reopened, "fresh") == "1", "delta over the snapshot survives restart");
+		check(value_of(reopened, "key0") == "v0", "snapshot keys survive restart");
+	}
+
+	// Окно кредитов сервера: пир, приславший кадров больше выданного, отключается;
+	// уложившийся в окно получает ответы и кредиты взамен разобранных кадров
+	void credit_window_enforced()
+	{
+		constexpr uint32_t WINDOW = 4;
+		asio::io_context io;
+		config_store store("");
+		write_combiner writes(io, store, write_combining{});
+		server_dispatcher dispatcher(store, writes);
+		timer_wheel wheel(io);
+		tcp::acceptor acceptor(io, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+		// count GET подряд, как их пришлёт клиент, и всё, что сервер ответит до закрытия или паузы
+		auto exchange = [&](tcp::socket& peer, uint16_t count) {
+			std::vector<uint8_t> request;
+			for(uint16_t id = 1; id <= count; ++id) {
+				const get_command cmd{ "key", id };
+				const size_t offset = request.size();
+				request.resize(offset + codec::frame_size(cmd));
+				memory_writer writer{ std::span<uint8_t>(request).subspan(offset) };
+				codec::encode_frame(writer, cmd);
+			}
+			asio::write(peer, asio::buffer(request));
+			io.run_for(200ms);
+
+			std::vector<uint8_t> received(64 * 1024);
+			error_code ec;
+			peer.non_blocking(true);
+			const size_t n = peer.read_some(asio::buffer(received), ec);
+			received.resize(ec ? 0 : n);
+
+			std::vector<std::vector<uint8_t>> frames;
+			for(size_t offset = 0; offset + MSG_SIZE_BYTES <= received.size();) {
+				uint32_t size = 0;
+				std::memcpy(&size, received.data() + offset, sizeof(size));
+				frames.emplace_back(received.begin() + offset, received.begin() + offset + size);
+				offset += size;
+			}
+			peer.read_some(asio::buffer(received), ec);   // после ответов: закрыт ли сокет
+			return std::make_pair(reply_log(frames), ec == asio::error::eof);
+		};
+
+		auto connect = [&](tcp::socket& peer) {
+			peer.connect(acceptor.local_endpoint());
+			auto conn = std::make_shared<t_connection<server_dispatcher>>(io, acceptor.accept(), dispatcher, wheel);
+			conn->set_flow_control(flow_control{ .credit_window = WINDOW });
+			conn->read(std::shared_ptr<void>());
+			return conn;
+		};
+
+		{
+			tcp::socket peer(io);
+			auto conn = connect(peer);
+			const auto [log, closed] = exchange(peer, WINDOW);
+			check(log.count("GET_RESPONSE") == WINDOW, "frames within the window are answered");
+			check(log.credits() == 2 * WINDOW, "initial window and returned credits are granted");
+			check(!closed, "peer within the window stays connected");
+
+			const auto [more, closed_after] = exchange(peer, WINDOW);
+			check(more.count("GET_RESPONSE") == WINDOW && !closed_after, "returned credits can be spent");
+		}
+
+		{
+			tcp::socket peer(io);
+			auto conn = connect(peer);
+			const auto [log, closed] = exchange(peer, WINDOW + 1);
+			check(closed, "peer beyond the window is disconnected");
+			check(log.count("GET_RESPONSE") <= WINDOW, "frames beyond the window are not answered");
+		}
+	}
+
+	// MULTI_SET по всем шардам и параллельные MULTI_GET тех же ключей:
+	// читатель видит пакет целиком или предыдущий, но не половину
+	void multi_set_is_atomic()
+	{
+		config_store store("", DEFAULT_SHARD_COUNT);
+		std::vector<std::string> names;
+		for(int i = 0; i < 64; ++i)
+			names.push_back("key" + std::to_string(i));
+		const std::vector<std::string_view> keys(names.begin(), names.end());
+
+		auto batch = [&](int n) {
+			std::vector<std::pair<std::string, std::string>> items;
+			for(const auto& key : names)
+				items.emplace_back(key, std::to_string(n));
+			return items;
+		};
+		store.set_many(batch(0));
+
+		std::atomic<bool> done{ false };
+		std::atomic<int> torn{ 0 };
+		std::vector<std::thread> readers;
+		for(int r = 0; r < 3; ++r) {
+			readers.emplace_back([&] {
+				while(!done.load()) {
+					std::vector<std::string> values(keys.size());
+					store.get_many(keys, [&](size_t i, const entry_ptr* e) { if(e) values[i] = (*e)->value(); });
+					if(std::any_of(values.begin(), values.end(), [&](const auto& v) { return v != values.front(); }))
+						++torn;
+				}
+			});
+		}
+
+		for(int n = 1; n <= 2000; ++n)
+			store.set_many(batch(n));
+		done = true;
+		for(auto& reader : readers)
+			reader.join();
+
+		check(torn == 0, "MULTI_GET never sees half of a MULTI_SET");
+	}
+
+	// Размер строки в дельте или старом снимке больше остатка файла — файл отвергается,
+	// а не заказывает память под строку, которой в нём нет
+	void oversized_length_rejected()
+	{
+		auto rejected = [](const std::string& file) {
+			try { config_store store(file, 1, wal_config{ fsync_policy::never }); }
+			catch(const std::runtime_error&) { return true; }
+			return false;
+		};
+
+		// [size_t count][size_t key size] и несколько байт вместо ключа
+		auto write_bad = [](const std::string& path, bool delta) {
+			std::ofstream out(path, std::ios::binary);
+			const size_t count = 1, huge = size_t(1) << 40;
+			out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+			if(delta) out.put(0);          // delta_op::set
+			out.write(reinterpret_cast<const char*>(&huge), sizeof(huge));
+			out.write("key", 3);
+		};
+
+		{
+			temp_dir dir;
+			write_bad(dir.file("config.dat"), false);
+			check(rejected(dir.file("config.dat")), "legacy snapshot with an oversized key is rejected");
+		}
+		{
+			temp_dir dir;
+			const std::string file = dir.file("config.dat");
+			{
+				config_store store(file, 1, wal_config{ fsync_policy::never });
+				store.set("key", "value");
+				store.compact();
+			}
+			write_bad(file + ".delta.1", true);
+			check(rejected(file), "delta with an oversized key is rejected");
+		}
+	}
+
+	const std::map<std::string_view, std::function<void()>> tests = {
+		{ "oversized_length_rejected", oversized_length_rejected },
+		{ "multi_set_is_atomic", multi_set_is_atomic },
+		{ "credit_window_enforced", credit_window_enforced },
+		{ "lazy_snapshot_load", lazy_snapshot_load },
+		{ "oversized_multi_get", oversized_multi_get },
+		{ "set_then_multi_set", set_then_multi_set },
+		{ "wal_recovers_after_snapshot", wal_recovers_after_snapshot },
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	try {
+		if(argc > 1) {
+			const auto it = tests.find(argv[1]);
+			if(it == tests.end()) {
+				std::cerr << "unknown test " << argv[1] << '\n';
+				return 2;
+			}
+			it->second();
+		}
+		else {
+			for(const auto& [name, test] : tests) {
+				std::cout << name << '\n';
+				test();
+			}
+		}
+	}
+	catch(const std::exception& e) {
+		std::cerr << "Fatal: " << e.what() << '\n';
+		return 1;
+	}
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+#include "snapshot_index.h"
+#include "checksum.h"
+
+#include <cstring>
+#include <stdexcept>
+
+uint32_t snapshot_header_checksum(snapshot_header h)
+{
+	h.header_crc = 0;
+	return checksum::crc32(&h, sizeof(h));
+}
+
+uint32_t snapshot_record_checksum(snapshot_record r, std::string_view key)
+{
+	r.record_crc = 0;
+	return checksum::crc32(key.data(), key.size(), checksum::crc32(&r, sizeof(r)));
+}
+
+snapshot_index::snapshot_index(std::shared_ptr<const mapped_file> file, const snapshot_header& header, std::string path)
+	: file_(std::move(file)), path_(std::move(path))
+{
+	const uint64_t size = file_->size();
+	if(header.data_offset > size || header.data_size > size - header.data_offset
+		|| header.index_offset > size || header.index_size > size - header.index_offset
+		|| header.count > header.index_size / sizeof(snapshot_record))
+		throw std::runtime_error("Snapshot " + path_ + " is truncated");
+
+	records_ = file_->data() + header.index_offset;
+	keys_ = records_ + header.count * sizeof(snapshot_record);
+	data_ = file_->data() + header.data_offset;
+	count_ = static_cast<size_t>(header.count);
+	keys_size_ = header.index_size - header.count * sizeof(snapshot_record);
+	data_size_ = header.data_size;
+}
+
+snapshot_record snapshot_index::record(size_t i) const
+{
+	snapshot_record r;
+	std::memcpy(&r, records_ + i * sizeof(r), sizeof(r));
+	if(r.key_offset > keys_size_ || r.key_size > keys_size_ - r.key_offset
+		|| r.value_offset > data_size_ || r.value_size > data_size_ - r.value_offset)
+		throw std::runtime_error("Snapshot " + path_ + ": index points outside the file");
+	return r;
+}
+
+std::string_view snapshot_index::key_of(const snapshot_record& r) const
+{
+	return { keys_ + r.key_offset, r.key_size };
+}
+
+snapshot_index::item snapshot_index::at(size_t i) const
+{
+	const snapshot_record r = record(i);
+	const std::string_view key = key_of(r);
+	if(snapshot_record_checksum(r, key) != r.record_crc)
+		throw std::runtime_error("Snapshot " + path_ + ": index record " + std::to_string(i) + " is corrupted");
+
+	// значение не читается: страницы подтянутся при первом GET
+	return { key, mapped_value{ file_, std::string_view(data_ + r.value_offset, r.value_size), r.value_crc } };
+}
+
+std::optional<snapshot_index::item> snapshot_index::find(std::string_view key) const
+{
+	// поиск смотрит только ключи; найденную запись at() сверит целиком
+	size_t low = 0, high = count_;
+	while(low < high) {
+		const size_t mid = low + (high - low) / 2;
+		const int order = key_of(record(mid)).compare(key);
+		if(order == 0) return at(mid);
+		if(order < 0) low = mid + 1;
+		else high = mid;
+	}
+	return std::nullopt;
+}
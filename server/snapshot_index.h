@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "mapped_file.h"
+
+// ---------- формат снимка ----------
+// [header][значения подряд][индекс]; смещение значения — от data_offset.
+// Версия 1: запись индекса — [uint32 key size][uint32 value size][uint64 value offset]
+// [uint32 value crc][key] в порядке обхода деревьев, index_crc — по всему индексу.
+// Версия 2: записи фиксированного размера по возрастанию ключа, за ними ключи подряд.
+// Ключ ищется двоичным поиском прямо в отображении, у каждой записи свой crc —
+// проверяется то, что читается, а не весь индекс при старте.
+constexpr char     SNAPSHOT_MAGIC[8] = { 'G', 'T', 'S', 'N', 'A', 'P', '\r', '\n' };
+constexpr uint32_t SNAPSHOT_VERSION  = 2;
+
+struct snapshot_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t header_crc;            // crc32 заголовка при header_crc = 0
+	uint32_t index_crc;             // только версия 1
+	uint32_t reserved;
+	uint64_t count;
+	uint64_t delta_seq;             // последняя дельта, уже вошедшая в снимок
+	uint64_t data_offset;
+	uint64_t data_size;
+	uint64_t index_offset;
+	uint64_t index_size;            // версия 2: записи и ключи
+};
+static_assert(sizeof(snapshot_header) == 72);
+
+struct snapshot_record {
+	uint64_t key_offset;            // от начала ключей
+	uint64_t value_offset;
+	uint32_t key_size;
+	uint32_t value_size;
+	uint32_t value_crc;
+	uint32_t record_crc;            // crc32 записи при record_crc = 0 и байтов ключа
+};
+static_assert(sizeof(snapshot_record) == 32);
+
+uint32_t snapshot_header_checksum(snapshot_header h);
+uint32_t snapshot_record_checksum(snapshot_record r, std::string_view key);
+
+// -----------------------------------------------------------------------------
+// Индекс снимка версии 2 поверх отображённого файла. Открытие проверяет только
+// заголовок и границы разделов; запись индекса сверяется со своим crc, когда её
+// читают (at, find). Пока хранилище не перенесло снимок в деревья шардов,
+// промахи по дереву ищутся здесь (см. config_store::load_base).
+// -----------------------------------------------------------------------------
+class snapshot_index
+{
+public:
+	struct item {
+		std::string_view key;
+		mapped_value     value;
+	};
+
+	// header уже проверен по своему crc и версии
+	snapshot_index(std::shared_ptr<const mapped_file> file, const snapshot_header& header, std::string path);
+
+	inline size_t size() const { return count_; }
+
+	// i-я запись по возрастанию ключа; повреждённая — исключение
+	item at(size_t i) const;
+
+	// nullopt — ключа в снимке нет
+	std::optional<item> find(std::string_view key) const;
+
+private:
+	snapshot_record record(size_t i) const;
+	std::string_view key_of(const snapshot_record& r) const;
+
+	std::shared_ptr<const mapped_file> file_;
+	std::string path_;                  // для сообщений об ошибках
+	const char* records_ = nullptr;
+	const char* keys_ = nullptr;
+	const char* data_ = nullptr;
+	size_t count_ = 0;
+	uint64_t keys_size_ = 0;
+	uint64_t data_size_ = 0;
+};
@@ -0,0 +1,79 @@
+#include "snapshot_writer.h"
+
+#include "config_store.h"
+
+#include <exception>
+#include <iostream>
+
+snapshot_writer::snapshot_writer(config_store& store)
+	: store_(store)
+	, thread_([this] { run(); })
+{}
+
+snapshot_writer::~snapshot_writer()
+{
+	{
+		std::lock_guard lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+}
+
+void snapshot_writer::request(bool force)
+{
+	{
+		std::lock_guard lock(mutex_);
+		requested_ = true;
+		force_ = force_ || force;
+	}
+	wake_.notify_one();
+}
+
+snapshot_stats snapshot_writer::stats() const
+{
+	std::lock_guard lock(mutex_);
+	return stats_;
+}
+
+void snapshot_writer::run()
+{
+	std::unique_lock lock(mutex_);
+	for(;;) {
+		wake_.wait(lock, [&] { return stop_ || requested_; });
+		if(stop_) return;
+
+		const bool force = force_;
+		requested_ = force_ = false;
+		lock.unlock();
+
+		if(force || store_.needs_compaction()) {
+			const auto start = std::chrono::steady_clock::now();
+			bool ok = true;
+			snapshot_result result;
+			try {
+				result = store_.compact();
+			}
+			catch(const std::exception& e) {
+				ok = false;
+				std::cerr << "Snapshot failed: " << e.what() << '\n';
+			}
+			const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+			lock.lock();
+			if(ok) {
+				++stats_.written;
+				stats_.last_duration = duration;
+				stats_.last_bytes = result.bytes;
+				stats_.last_changes = result.changes;
+				stats_.last_full = result.full;
+			}
+			else {
+				++stats_.failed;
+			}
+			continue;
+		}
+
+		lock.lock();
+	}
+}
@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+class config_store;
+
+struct snapshot_stats
+{
+	std::uint64_t             written  = 0;   // снимков с запуска
+	std::uint64_t             failed   = 0;
+	std::chrono::milliseconds last_duration{ 0 };
+	std::size_t               last_bytes   = 0;
+	std::size_t               last_changes = 0;   // записей: изменённых ключей в дельте, всех — в полном
+	bool                      last_full    = false;
+};
+
+// -----------------------------------------------------------------------------
+// Фоновая запись снимков.
+// io-потоки только ставят запрос (request) — без диска и без ожидания;
+// свой поток сворачивает журнал в снимок (config_store::compact) и
+// запоминает длительность и размер. Запросы, пришедшие во время записи,
+// склеиваются в один следующий.
+// -----------------------------------------------------------------------------
+class snapshot_writer
+{
+public:
+	explicit snapshot_writer(config_store& store);
+	~snapshot_writer();
+
+	snapshot_writer(const snapshot_writer&) = delete;
+	snapshot_writer& operator=(const snapshot_writer&) = delete;
+
+	// Не блокирует. force — писать, даже если журнал ещё мал
+	void request(bool force = false);
+
+	snapshot_stats stats() const;
+
+private:
+	void run();
+
+	config_store&           store_;
+
+	mutable std::mutex      mutex_;
+	std::condition_variable wake_;
+	bool                    requested_ = false;
+	bool                    force_     = false;
+	bool                    stop_      = false;
+	snapshot_stats          stats_;
+
+	std::thread             thread_;
+};
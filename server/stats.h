@@ -0,0 +1,147 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+// Собирать ли счётчики чтений по ключам (CMake: -DPER_KEY_STATS=OFF — не собирать)
+#ifndef PER_KEY_STATS
+#define PER_KEY_STATS 1
+#endif
+
+// Ячейка потока: номер раздаётся по кругу при первом обращении потока
+inline size_t this_thread_cell()
+{
+	static std::atomic<size_t> next{ 0 };
+	thread_local const size_t cell = next.fetch_add(1, std::memory_order_relaxed);
+	return cell;
+}
+
+// -----------------------------------------------------------------------------
+// Счётчик, разнесённый по ячейкам на отдельных кэш-линиях.
+// Поток пишет только в свою ячейку, сумма собирается при чтении.
+// -----------------------------------------------------------------------------
+template<size_t N>
+class sharded_counter
+{
+public:
+	// Возвращает новое значение своей ячейки
+	inline uint64_t add(uint64_t n = 1)
+	{
+		return cells_[this_thread_cell() % N].value.fetch_add(n, std::memory_order_relaxed) + n;
+	}
+
+	uint64_t load() const
+	{
+		uint64_t sum = 0;
+		for(const auto& c : cells_)
+			sum += c.value.load(std::memory_order_relaxed);
+		return sum;
+	}
+
+private:
+	struct alignas(64) cell
+	{
+		std::atomic<uint64_t> value{ 0 };
+	};
+
+	std::array<cell, N> cells_;
+};
+
+// -----------------------------------------------------------------------------
+// Чтения ключа.
+// Пока ключ холодный — один атомик; набрав INFLATE_AFTER чтений, ключ получает
+// разнесённый счётчик, и дальше горячий ключ не гоняет одну линию между ядрами.
+// Память под ячейки тратится только на горячие ключи.
+// reads() стоит в каждом ответе на GET, поэтому ячейки он не суммирует: поток
+// переносит в общий итог published по PUBLISH_EVERY своих чтений. У горячего
+// ключа reads — приближение снизу, отстаёт не больше чем на CELLS × PUBLISH_EVERY.
+// -----------------------------------------------------------------------------
+class sharded_key_stats
+{
+public:
+	static constexpr bool     enabled       = true;
+	static constexpr size_t   CELLS         = 16;
+	static constexpr uint64_t INFLATE_AFTER = 1024;
+	static constexpr uint64_t PUBLISH_EVERY = 64;
+
+	~sharded_key_stats() { delete hot_.load(std::memory_order_relaxed); }
+
+	inline void add_read()
+	{
+		if(auto* hot = hot_.load(std::memory_order_acquire)) {
+			if(hot->cells.add() % PUBLISH_EVERY == 0)
+				hot->published.fetch_add(PUBLISH_EVERY, std::memory_order_relaxed);
+			return;
+		}
+		if(cold_.fetch_add(1, std::memory_order_relaxed) + 1 == INFLATE_AFTER)
+			inflate();
+	}
+
+	inline uint64_t reads() const
+	{
+		const auto* hot = hot_.load(std::memory_order_acquire);
+		return cold_.load(std::memory_order_relaxed) + (hot ? hot->published.load(std::memory_order_relaxed) : 0);
+	}
+
+private:
+	struct hot_counter
+	{
+		sharded_counter<CELLS>            cells;
+		alignas(64) std::atomic<uint64_t> published{ 0 }; // своя линия: ячейки её не задевают
+	};
+
+	void inflate()
+	{
+		auto* hot = new hot_counter();
+		hot_counter* expected = nullptr;
+		if(!hot_.compare_exchange_strong(expected, hot, std::memory_order_acq_rel))
+			delete hot;
+	}
+
+	std::atomic<uint64_t>     cold_{ 0 };
+	std::atomic<hot_counter*> hot_{ nullptr };
+};
+
+// Счётчики по ключам выключены: чтение ключа ничего не пишет, reads всегда 0
+class no_key_stats
+{
+public:
+	static constexpr bool enabled = false;
+
+	inline void     add_read() {}
+	inline uint64_t reads() const { return 0; }
+};
+
+using key_stats = std::conditional_t<PER_KEY_STATS != 0, sharded_key_stats, no_key_stats>;
+
+// Счётчики нового ключа; при выключенных — один общий пустой объект на всех
+inline std::shared_ptr<key_stats> make_key_stats()
+{
+	if constexpr(key_stats::enabled) {
+		return std::make_shared<key_stats>();
+	}
+	else {
+		static const auto shared = std::make_shared<key_stats>();
+		return shared;
+	}
+}
+
+// ---------- статистика запросов ----------
+struct counters {
+	static constexpr size_t CELLS = 64;
+
+	sharded_counter<CELLS> get_total, set_total;
+
+	inline void add_get(uint64_t n = 1) { get_total.add(n); }
+	inline void add_set(uint64_t n = 1) { set_total.add(n); }
+
+	// Вызывается с одного таймера: окно — разница с прошлым выводом
+	void dump_and_reset();
+
+private:
+	uint64_t get_dumped_ = 0, set_dumped_ = 0;
+};
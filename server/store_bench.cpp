@@ -0,0 +1,158 @@
+#include "store_bench.h"
+#include "config_store.h"
+#include "server_dispatcher.h"
+#include "write_combiner.h"
+
+#include <immer/atom.hpp>
+#include <immer/map_transient.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	constexpr size_t BENCH_KEYS = 10000;
+
+	std::vector<std::string> make_keys()
+	{
+		std::vector<std::string> keys;
+		keys.reserve(BENCH_KEYS);
+		for(size_t i = 0; i < BENCH_KEYS; ++i)
+			keys.push_back("benchKey" + std::to_string(i));
+		return keys;
+	}
+
+	// Запускает threads потоков по ops_per_thread вызовов op(key), возвращает операций в секунду
+	template<class F>
+	double measure(size_t threads, size_t ops_per_thread, const std::vector<std::string>& keys, F op)
+	{
+		std::atomic<bool> go{ false };
+		std::vector<std::thread> pool;
+		for(size_t i = 0; i < threads; ++i) {
+			pool.emplace_back([&, seed = i] {
+				std::mt19937 rng(static_cast<uint32_t>(seed));
+				std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+				while(!go.load(std::memory_order_acquire)) {}
+
+				for(size_t n = 0; n < ops_per_thread; ++n)
+					op(keys[pick(rng)]);
+			});
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		go.store(true, std::memory_order_release);
+		for(auto& t : pool) t.join();
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		return static_cast<double>(threads * ops_per_thread) / elapsed.count();
+	}
+
+	// Сокет замера: ответ кодируется в буфер потока — как в арену соединения на проходе разбора
+	class bench_socket final : public i_socket
+	{
+	public:
+		void send(const message& msg) override
+		{
+			std::visit([](const auto& cmd) {
+				memory_writer writer{ buffer(codec::frame_size(cmd)) };
+				codec::encode_frame(writer, cmd);
+			}, msg);
+		}
+
+		void send_many(std::span<const message> msgs) override
+		{
+			for(const auto& msg : msgs)
+				send(msg);
+		}
+
+		void send(const prepared_get_response& frame, uint16_t request_id, uint64_t reads, uint64_t writes) override
+		{
+			frame.write(buffer(frame.size()), request_id, reads, writes);
+		}
+
+	private:
+		static std::span<uint8_t> buffer(size_t size)
+		{
+			thread_local std::vector<uint8_t> out;
+			if(out.size() < size) out.resize(size);
+			return { out.data(), size };
+		}
+	};
+}
+
+void run_store_bench(size_t max_threads, size_t shard_count, size_t ops_per_thread)
+{
+	const auto keys = make_keys();
+
+	std::cout << "[Bench] SET/s, " << ops_per_thread << " ops per thread\n";
+	for(size_t threads = 1; threads <= max_threads; threads *= 2) {
+		double result[2];
+		const size_t shards[2] = { 1, shard_count };
+		for(int i = 0; i < 2; ++i) {
+			config_store store("", shards[i]); // без файла: только память
+			result[i] = measure(threads, ops_per_thread, keys,
+				[&](const std::string& key) { store.set(key, "benchValue"); });
+		}
+
+		std::cout << "[Bench] threads=" << threads
+			<< " | 1 shard: " << static_cast<uint64_t>(result[0])
+			<< " | " << shard_count << " shards: " << static_cast<uint64_t>(result[1]) << '\n';
+	}
+}
+
+void run_get_bench(size_t max_threads, size_t shard_count, size_t ops_per_thread)
+{
+	const auto keys = make_keys();
+
+	config_store store("", shard_count);
+	boost::asio::io_context io;
+	write_combiner writes(io, store, {});
+	server_dispatcher dispatcher(store, writes);
+	const i_socket_ptr socket = std::make_shared<bench_socket>();
+
+	immer::atom<map> atom_root;         // прежний путь: снимок через atom::load и копия entry_ptr
+	{
+		auto t = map{}.transient();
+		for(const auto& key : keys) {
+			store.set(key, "benchValue");
+			t.set(key, std::make_shared<const entry>("benchValue", 1, make_key_stats()));
+		}
+		atom_root.store(t.persistent());
+	}
+
+	std::cout << "[Bench] GET/s, " << ops_per_thread << " ops per thread\n";
+	const std::vector<std::string> hot_key{ keys.front() };
+	for(size_t threads = 1; threads <= max_threads; threads *= 2) {
+		std::atomic<size_t> sink{ 0 };
+		std::atomic<uint64_t> shared_reads{ 0 }, shared_total{ 0 }, shared_window{ 0 };
+
+		// прежний путь: atom::load, копия entry_ptr, общий атомик ключа и два глобальных
+		const double atom_rate = measure(threads, ops_per_thread, keys, [&](const std::string& key) {
+			auto snap = atom_root.load();
+			if(auto p = snap->find(key)) {
+				entry_ptr e = *p;
+				shared_reads.fetch_add(1, std::memory_order_relaxed);
+				shared_total.fetch_add(1, std::memory_order_relaxed);
+				shared_window.fetch_add(1, std::memory_order_relaxed);
+				if(e->value().empty()) sink.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+
+		// нынешний путь целиком: эпоха, reads(), кэш готовых кадров и кодирование ответа
+		auto dispatcher_get = [&](const std::string& key) {
+			dispatcher.process(get_command{ key, 1 }, socket);
+		};
+		const double dispatcher_rate = measure(threads, ops_per_thread, keys, dispatcher_get);
+		const double hot_rate = measure(threads, ops_per_thread, hot_key, dispatcher_get);
+
+		std::cout << "[Bench] threads=" << threads
+			<< " | atom+refcount: " << static_cast<uint64_t>(atom_rate)
+			<< " | dispatcher: " << static_cast<uint64_t>(dispatcher_rate)
+			<< " | dispatcher, one hot key: " << static_cast<uint64_t>(hot_rate) << '\n';
+	}
+}
@@ -0,0 +1,17 @@
+﻿#pragma once
+
+#include <cstddef>
+
+// -----------------------------------------------------------------------------
+// Замеры хранилища без сети.
+// Для каждого числа потоков 1, 2, 4 … max_threads каждый поток делает
+// ops_per_thread операций по случайным ключам.
+// -----------------------------------------------------------------------------
+
+// SET/s для одного шарда и для shard_count шардов
+void run_store_bench(size_t max_threads, size_t shard_count, size_t ops_per_thread);
+
+// GET/s: снимок через immer::atom (спинлок и счётчик ссылок) против полного пути
+// server_dispatcher (эпоха, reads(), кэш кадров, кодирование ответа), и тот же путь,
+// когда все потоки читают один горячий ключ
+void run_get_bench(size_t max_threads, size_t shard_count, size_t ops_per_thread);
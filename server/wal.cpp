@@ -0,0 +1,286 @@
+#include "wal.h"
+#include "checksum.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+bool sync_file(std::FILE* f)
+{
+	if(std::fflush(f) != 0) return false;
+#ifdef _WIN32
+	return _commit(_fileno(f)) == 0;
+#else
+	return fsync(fileno(f)) == 0;
+#endif
+}
+
+void sync_path(const std::string& path)
+{
+	std::FILE* f = std::fopen(path.c_str(), "rb+");
+	if(!f)
+		throw std::ios_base::failure("Failed to open file for sync: " + path);
+	const bool synced = sync_file(f);
+	std::fclose(f);
+	if(!synced)
+		throw std::ios_base::failure("Failed to sync file: " + path);
+}
+
+namespace
+{
+	bool get_u32(const std::vector<char>& in, std::size_t& offset, std::uint32_t& v)
+	{
+		if(in.size() - offset < sizeof(v)) return false;
+		std::memcpy(&v, in.data() + offset, sizeof(v));
+		offset += sizeof(v);
+		return true;
+	}
+
+	bool get_string(const std::vector<char>& in, std::size_t& offset, std::string& s)
+	{
+		std::uint32_t size;
+		if(!get_u32(in, offset, size) || in.size() - offset < size) return false;
+		s.assign(in.data() + offset, size);
+		offset += size;
+		return true;
+	}
+}
+
+std::vector<std::pair<std::uint64_t, std::string>> list_numbered(const std::string& base)
+{
+	const fs::path base_path(base);
+	const fs::path dir = base_path.has_parent_path() ? base_path.parent_path() : fs::path(".");
+	const std::string prefix = base_path.filename().string() + ".";
+
+	std::vector<std::pair<std::uint64_t, std::string>> segments;
+	std::error_code ec;
+	for(const auto& item : fs::directory_iterator(dir, ec)) {
+		const std::string name = item.path().filename().string();
+		if(!name.starts_with(prefix)) continue;
+
+		const std::string number = name.substr(prefix.size());
+		if(number.empty() || !std::all_of(number.begin(), number.end(), [](char c) { return c >= '0' && c <= '9'; }))
+			continue;
+
+		segments.emplace_back(std::stoull(number), item.path().string());
+	}
+
+	std::sort(segments.begin(), segments.end());
+	return segments;
+}
+
+void write_ahead_log::replay(const std::string& base, const record_handler& handler)
+{
+	for(const auto& [n, path] : list_numbered(base)) {
+		std::error_code ec;
+		const auto file_size = static_cast<std::size_t>(fs::file_size(path, ec));
+		std::FILE* f = ec ? nullptr : std::fopen(path.c_str(), "rb");
+		if(!f) continue;
+
+		std::vector<char> payload;
+		for(std::size_t left = file_size;;) {
+			std::uint32_t header[2]; // size, crc
+			if(std::fread(header, sizeof(header), 1, f) != 1) break;
+			left -= std::min(left, sizeof(header));
+
+			// размер не проверен crc: мусорный не должен заказать гигабайты
+			if(header[0] < 2 * sizeof(std::uint32_t) || header[0] > MAX_RECORD_SIZE || header[0] > left) {
+				std::cerr << "WAL: torn record in " << path << ", rest of segment dropped\n";
+				break;
+			}
+			left -= header[0];
+
+			payload.resize(header[0]);
+			std::string key, value;
+			std::size_t offset = 0;
+			if(std::fread(payload.data(), 1, payload.size(), f) != payload.size()
+				|| checksum::crc32(payload.data(), payload.size()) != header[1]
+				|| !get_string(payload, offset, key) || !get_string(payload, offset, value)) {
+				std::cerr << "WAL: torn record in " << path << ", rest of segment dropped\n";
+				break;
+			}
+
+			handler(std::move(key), std::move(value));
+		}
+		std::fclose(f);
+	}
+}
+
+write_ahead_log::write_ahead_log(std::string base, const wal_config& config)
+	: base_(std::move(base)), config_(config)
+{
+	std::uint64_t last = 0;
+	for(const auto& [n, path] : list_numbered(base_)) {
+		last = n;
+
+		std::error_code ec;
+		const auto size = static_cast<std::size_t>(fs::file_size(path, ec));
+		if(!ec && size == 0) {           // пустой сегмент от прошлого запуска — нечего хранить
+			fs::remove(path, ec);
+			continue;
+		}
+		segment_bytes_[n] = ec ? 0 : size;
+		bytes_ += segment_bytes_[n];
+	}
+
+	open_segment(last + 1); // старые сегменты только читаются: хвост мог оборваться
+	writer_ = std::thread([this] { run(); });
+}
+
+write_ahead_log::~write_ahead_log()
+{
+	{
+		std::lock_guard lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+	writer_.join();
+
+	std::fclose(file_);
+}
+
+std::string write_ahead_log::segment_path(std::uint64_t n) const
+{
+	return base_ + "." + std::to_string(n);
+}
+
+void write_ahead_log::open_segment(std::uint64_t n)
+{
+	file_ = std::fopen(segment_path(n).c_str(), "ab");
+	if(!file_)
+		throw std::ios_base::failure("Failed to open WAL segment " + segment_path(n));
+
+	segment_ = n;
+	segment_bytes_[n] = 0;
+}
+
+void write_ahead_log::append(const std::string& key, const std::string& value)
+{
+	if(2 * sizeof(std::uint32_t) + key.size() + value.size() > MAX_RECORD_SIZE)
+		throw std::length_error("WAL: record too large");
+	const std::uint32_t payload_size = static_cast<std::uint32_t>(2 * sizeof(std::uint32_t) + key.size() + value.size());
+
+	// запись и crc собираются до замка: под mutex_ только дописать готовые байты и взять номер
+	thread_local std::vector<char> record;
+	record.resize(2 * sizeof(std::uint32_t) + payload_size);
+
+	char* payload = record.data() + 2 * sizeof(std::uint32_t);
+	char* out = payload;
+	const auto put = [&out](const void* src, std::size_t size) {
+		std::memcpy(out, src, size);
+		out += size;
+	};
+	const auto key_size = static_cast<std::uint32_t>(key.size());
+	const auto value_size = static_cast<std::uint32_t>(value.size());
+	put(&key_size, sizeof(key_size));
+	put(key.data(), key.size());
+	put(&value_size, sizeof(value_size));
+	put(value.data(), value.size());
+
+	const std::uint32_t crc = checksum::crc32(payload, payload_size);
+	std::memcpy(record.data(), &payload_size, sizeof(payload_size));
+	std::memcpy(record.data() + sizeof(std::uint32_t), &crc, sizeof(crc));
+
+	std::lock_guard lock(mutex_);
+	if(failed_)
+		throw std::runtime_error("WAL: log is not writable after an earlier write failure");
+
+	pending_.insert(pending_.end(), record.begin(), record.end());
+
+	if(config_.fsync == fsync_policy::always || pending_.size() >= WAKE_BYTES)
+		wake_.notify_one();
+}
+
+std::uint64_t write_ahead_log::rotate()
+{
+	std::lock_guard file_lock(file_mutex_);
+	write_pending(true);
+
+	std::fclose(file_);
+	const std::uint64_t closed = segment_;
+	open_segment(closed + 1);
+	return closed;
+}
+
+void write_ahead_log::drop_segments(std::uint64_t last)
+{
+	std::lock_guard file_lock(file_mutex_);
+	for(auto it = segment_bytes_.begin(); it != segment_bytes_.end() && it->first <= last;) {
+		if(it->first == segment_) break;
+
+		std::error_code ec;
+		fs::remove(segment_path(it->first), ec);
+		bytes_ -= it->second;
+		it = segment_bytes_.erase(it);
+	}
+
+	// после ошибки append() не проходил, новый сегмент чист — снимок покрыл всё
+	std::lock_guard lock(mutex_);
+	if(failed_ && failed_segment_ <= last) {
+		failed_ = false;
+		std::cerr << "WAL: recovered, snapshot covers segment " << failed_segment_ << ", SETs are accepted again\n";
+	}
+}
+
+bool write_ahead_log::failed() const
+{
+	std::lock_guard lock(mutex_);
+	return failed_;
+}
+
+void write_ahead_log::run()
+{
+	for(;;) {
+		bool stopping;
+		{
+			std::unique_lock lock(mutex_);
+			wake_.wait_for(lock, config_.interval, [&] {
+				return stop_ || pending_.size() >= WAKE_BYTES
+					|| (config_.fsync == fsync_policy::always && !pending_.empty());
+			});
+			stopping = stop_;
+		}
+
+		std::lock_guard file_lock(file_mutex_);
+		write_pending(config_.fsync != fsync_policy::never || stopping);
+		if(stopping) return;
+	}
+}
+
+void write_ahead_log::write_pending(bool sync)
+{
+	std::vector<char> buffer;
+	{
+		std::lock_guard lock(mutex_);
+		if(pending_.empty()) return;
+		buffer.swap(pending_);
+	}
+
+	// одна запись и один fsync на всё, что набралось, — group commit
+	const bool written = std::fwrite(buffer.data(), 1, buffer.size(), file_) == buffer.size()
+		&& (sync ? sync_file(file_) : std::fflush(file_) == 0);
+
+	segment_bytes_[segment_] += buffer.size();
+	bytes_ += buffer.size();
+
+	if(!written) {
+		std::lock_guard lock(mutex_);
+		if(!failed_) {
+			// хвост сегмента мог оборваться: дописывать после него нельзя
+			std::cerr << "WAL: write failed, SETs are rejected until the next snapshot\n";
+			failed_ = true;
+			failed_segment_ = segment_;
+			pending_.clear();
+		}
+	}
+}
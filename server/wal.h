@@ -0,0 +1,112 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class fsync_policy
+{
+	never,    // только write: надёжность на усмотрение ОС
+	interval, // fsync раз в interval — теряется не больше интервала
+	always,   // fsync сразу за каждой записью (group commit: один fsync на всё набежавшее)
+};
+
+struct wal_config
+{
+	fsync_policy              fsync         = fsync_policy::interval;
+	std::chrono::milliseconds interval{ 100 };
+	std::size_t               compact_bytes = 64 * 1024 * 1024; // журнал больше — свернуть в снимок
+	std::size_t               full_every    = 8;  // дельт между полными снимками; 0 — всегда полный
+};
+
+// Сбросить файл на диск (fsync / _commit); false — ОС не смогла
+bool sync_file(std::FILE* f);
+void sync_path(const std::string& path);
+
+// Файлы <base>.<N> по возрастанию N: сегменты журнала, дельты снимка
+std::vector<std::pair<std::uint64_t, std::string>> list_numbered(const std::string& base);
+
+// -----------------------------------------------------------------------------
+// Журнал записей (write-ahead log).
+// Журнал — последовательность сегментов <base>.<N>; SET дописывается в текущий.
+// Запись: [uint32 size][uint32 crc32][uint32 key size][key][uint32 value size][value].
+// append() только копирует запись в буфер; отдельный поток пишет буфер одним
+// write и делает fsync по политике — запись на диск пропорциональна потоку SET.
+// Ответа на SET в протоколе нет, поэтому io-потоки fsync не ждут ни при какой
+// политике: always лишь будит писателя на каждую запись.
+// Снимок хранилища + все сегменты по порядку = текущее состояние; после
+// записи снимка сегменты до rotate() включительно удаляются.
+// Ошибка записи или fsync запоминается: следующие append() получают
+// исключение — SET, которые нельзя сохранить, не публикуются. Снимок после
+// rotate() покрывает всё опубликованное, в том числе потерянное журналом:
+// drop_segments() за сегментом с ошибкой снимает запрет, журнал пишется дальше.
+// -----------------------------------------------------------------------------
+class write_ahead_log
+{
+public:
+	using record_handler = std::function<void(std::string key, std::string value)>;
+
+	// Предел записи: SET приходит одним кадром, здесь — с большим запасом.
+	// При чтении размер сверх предела или сверх остатка файла — оборванный хвост
+	static constexpr std::size_t MAX_RECORD_SIZE = 64 * 1024 * 1024;
+
+	// Прочитать все сегменты base по порядку. Оборванный хвост сегмента отбрасывается
+	static void replay(const std::string& base, const record_handler& handler);
+
+	write_ahead_log(std::string base, const wal_config& config);
+	~write_ahead_log();
+
+	write_ahead_log(const write_ahead_log&) = delete;
+	write_ahead_log& operator=(const write_ahead_log&) = delete;
+
+	// Вызывать под тем же замком, что и публикацию: порядок в журнале = порядок применения.
+	// Запись больше MAX_RECORD_SIZE — std::length_error; после ошибки записи — std::runtime_error
+	void append(const std::string& key, const std::string& value);
+
+	// Закрыть текущий сегмент и начать новый; возвращает номер закрытого
+	std::uint64_t rotate();
+
+	// Удалить сегменты с номером <= last (их содержимое уже в снимке).
+	// Ошибка записи в одном из них больше не мешает: запрет на append() снимается
+	void drop_segments(std::uint64_t last);
+
+	// Была ошибка записи, и снимок её ещё не покрыл
+	bool failed() const;
+
+	inline std::size_t size_bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+private:
+	static constexpr std::size_t WAKE_BYTES = 1024 * 1024; // столько накопилось — писать, не дожидаясь интервала
+
+	std::string segment_path(std::uint64_t n) const;
+
+	void open_segment(std::uint64_t n);
+	void run();
+	void write_pending(bool sync); // под file_mutex_
+
+	const std::string base_;
+	const wal_config  config_;
+
+	std::mutex              file_mutex_; // файл и сегменты; берётся раньше mutex_
+	mutable std::mutex      mutex_;      // буфер и флаги
+	std::condition_variable wake_;     // писателю: есть срочная работа
+	std::vector<char>       pending_;
+	bool                    stop_         = false;
+	bool                    failed_       = false; // запись или fsync не удались — журнал не пишется до снимка
+	std::uint64_t           failed_segment_ = 0;   // сегмент, где случилась ошибка
+
+	std::FILE*                            file_    = nullptr;
+	std::uint64_t                         segment_ = 0;
+	std::map<std::uint64_t, std::size_t>  segment_bytes_;
+	std::atomic<std::size_t>              bytes_{ 0 };
+
+	std::thread writer_;
+};
@@ -0,0 +1,126 @@
+#include "write_combiner.h"
+
+#include "config_store.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace asio = boost::asio;
+
+write_combiner::write_combiner(asio::io_context& io, config_store& store, const write_combining& config)
+	: store_(store)
+	, config_(config)
+	, strand_(asio::make_strand(io.get_executor()))
+	, timer_(strand_)
+{}
+
+write_combiner::~write_combiner()
+{
+	drain(); // не теряем то, что не успело уйти
+}
+
+void write_combiner::submit(std::string key, std::string value, callback on_published)
+{
+	if(!enabled()) {
+		store_.set(key, std::move(value));
+		if(on_published) on_published();
+		return;
+	}
+
+	push(new node{ std::move(key), std::move(value), {}, std::move(on_published) });
+}
+
+void write_combiner::submit_many(std::vector<item> items, callback on_published)
+{
+	if(items.empty()) return;
+
+	if(!enabled()) {
+		store_.set_many(items);
+		if(on_published) on_published();
+		return;
+	}
+
+	push(new node{ {}, {}, std::move(items), std::move(on_published) });
+}
+
+void write_combiner::push(node* n)
+{
+	n->next = head_.load(std::memory_order_relaxed);
+	while(!head_.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)) {}
+
+	const auto added = static_cast<std::int64_t>(n->size());
+	const auto count = pending_.fetch_add(added, std::memory_order_relaxed) + added;
+	const auto limit = static_cast<std::int64_t>(config_.max_batch);
+	if(count >= limit && count - added < limit)
+		asio::post(strand_, [this] { drain(); });              // пачка набралась — не ждём
+	else if(count == added)
+		asio::post(strand_, [this] { schedule(); });           // первый в пачке — заводим срок
+}
+
+void write_combiner::schedule()
+{
+	if(config_.max_delay.count() == 0) {
+		drain();
+		return;
+	}
+
+	timer_.expires_after(config_.max_delay);
+	timer_.async_wait([this](const boost::system::error_code& ec) {
+		if(!ec) drain();
+	});
+}
+
+void write_combiner::drain()
+{
+	node* list = head_.exchange(nullptr, std::memory_order_acquire);
+	if(!list) return;
+
+	// стек хранит обратный порядок — разворачиваем, чтобы последний SET ключа победил
+	std::vector<node*> nodes;
+	for(; list; list = list->next)
+		nodes.push_back(list);
+	std::reverse(nodes.begin(), nodes.end());
+
+	// за время ожидания могло накопиться больше max_batch — публикуем частями;
+	// MULTI_SET целиком попадает в одну часть, даже если она выйдет больше max_batch
+	std::vector<item> items;
+	std::int64_t drained = 0;
+	for(size_t begin = 0; begin < nodes.size();) {
+		size_t end = begin;
+		items.clear();
+		for(; end < nodes.size() && items.size() < config_.max_batch; ++end) {
+			node& n = *nodes[end];
+			if(n.items.empty())
+				items.emplace_back(std::move(n.key), std::move(n.value));
+			else
+				std::move(n.items.begin(), n.items.end(), std::back_inserter(items));
+			drained += static_cast<std::int64_t>(n.size());
+		}
+
+		bool published = true;
+		try {
+			store_.set_many(items);
+			batches_.fetch_add(1, std::memory_order_relaxed);
+			combined_.fetch_add(items.size(), std::memory_order_relaxed);
+		}
+		catch(const std::exception& e) {
+			// журнал не пишется — пачка не сохранена; strand и остальные пачки живут дальше
+			std::cerr << "SET batch of " << items.size() << " failed: " << e.what() << '\n';
+			published = false;
+		}
+
+		for(size_t i = begin; i < end; ++i) {
+			if(published && nodes[i]->on_published) nodes[i]->on_published();
+			delete nodes[i];
+		}
+		begin = end;
+	}
+
+	timer_.cancel();
+	// пока применяли, могли прийти новые: их счёт не с нуля, срок никто не завёл
+	if(pending_.fetch_sub(drained, std::memory_order_relaxed) > drained)
+		schedule();
+}
@@ -0,0 +1,79 @@
+﻿#pragma once
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+class config_store;
+
+struct write_combining
+{
+	std::size_t               max_batch = 0;   // SET в одной версии; 0 — писать в хранилище сразу
+	std::chrono::microseconds max_delay{ 200 }; // сколько первый SET пачки может ждать попутчиков
+};
+
+// -----------------------------------------------------------------------------
+// Объединение записей.
+// SET кладутся в lock-free MPSC-стек; применяет их один strand: вся пачка —
+// одна transient-версия на шард (config_store::set_many) вместо версии на SET.
+// Пачка уходит, когда набралось max_batch или истёк max_delay.
+// MULTI_SET идёт той же очередью одним узлом: порядок с SET сохраняется,
+// и его записи не делятся между пачками.
+// GET по-прежнему читают опубликованный снимок: SET виден после публикации
+// своей пачки — кому это важно, передаёт on_published.
+// -----------------------------------------------------------------------------
+class write_combiner
+{
+public:
+	using callback = std::function<void()>;
+
+	write_combiner(boost::asio::io_context& io, config_store& store, const write_combining& config);
+	~write_combiner();
+
+	write_combiner(const write_combiner&) = delete;
+	write_combiner& operator=(const write_combiner&) = delete;
+
+	// Потокобезопасно. on_published вызывается на strand после публикации пачки
+	void submit(std::string key, std::string value, callback on_published = {});
+	void submit_many(std::vector<std::pair<std::string, std::string>> items, callback on_published = {});
+
+	inline bool enabled() const { return config_.max_batch > 0; }
+
+	inline std::uint64_t batches() const { return batches_.load(std::memory_order_relaxed); }
+	inline std::uint64_t combined() const { return combined_.load(std::memory_order_relaxed); }
+
+private:
+	using item = std::pair<std::string, std::string>;
+
+	struct node
+	{
+		std::string       key;          // SET
+		std::string       value;
+		std::vector<item> items;        // MULTI_SET: непустой — узел несёт всю пачку
+		callback          on_published;
+		node*             next = nullptr;
+
+		inline size_t size() const { return items.empty() ? 1 : items.size(); }
+	};
+
+	void push(node* n);
+	void schedule();
+	void drain();
+
+	config_store&                                           store_;
+	const write_combining                                   config_;
+	boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+	boost::asio::steady_timer                               timer_;
+
+	std::atomic<node*>        head_{ nullptr };  // стек: новые сверху
+	std::atomic<std::int64_t> pending_{ 0 };     // записей в стеке; может кратко уйти в минус: drain опередил счёт
+
+	std::atomic<std::uint64_t> batches_{ 0 };
+	std::atomic<std::uint64_t> combined_{ 0 };
+};